@@ -0,0 +1,145 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "common.h"
+
+/*
+ * Bump allocator over a chain of blocks. Nothing is freed individually;
+ * arena_reset rewinds to the first block in O(1) and keeps every block for
+ * reuse, so a query's scratch memory is released in one step and steady
+ * state queries never call malloc.
+ *
+ * The mem_* helpers take an optional arena and fall back to the C heap when
+ * it is NULL, which lets DynArr, HashMap and the heaps share one code path.
+ */
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_BLOCK (1 << 20)
+
+typedef struct ArenaBlock {
+	struct ArenaBlock *next;
+	u64 size;
+	u64 capacity;
+	u8 *data;
+} ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock *head;
+	ArenaBlock *current;
+	u64 block_size;
+} Arena;
+
+static ArenaBlock *arena_new_block(u64 capacity) {
+	ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock));
+	block->next = NULL;
+	block->size = 0;
+	block->capacity = capacity;
+	block->data = (u8 *)malloc(capacity);
+	return block;
+}
+
+Arena *arena_sized_init(u64 block_size) {
+	Arena *arena = (Arena *)malloc(sizeof(Arena));
+	arena->block_size = block_size;
+	arena->head = arena_new_block(block_size);
+	arena->current = arena->head;
+	return arena;
+}
+
+Arena *arena_init() {
+	return arena_sized_init(ARENA_DEFAULT_BLOCK);
+}
+
+void *arena_alloc(Arena *arena, u64 size) {
+	size = (size + (ARENA_ALIGN - 1)) & ~((u64)ARENA_ALIGN - 1);
+
+	ArenaBlock *block = arena->current;
+	while (block->size + size > block->capacity) {
+		ArenaBlock *next = block->next;
+		if (next == NULL || next->capacity < size) {
+			u64 capacity = (size > arena->block_size) ? size : arena->block_size;
+			debug("[ARENA] adding block of %llu bytes for a %llu byte allocation\n", capacity, size);
+			ArenaBlock *fresh = arena_new_block(capacity);
+			fresh->next = next;
+			block->next = fresh;
+			next = fresh;
+		}
+		next->size = 0;
+		block = next;
+	}
+	arena->current = block;
+
+	void *ret = block->data + block->size;
+	block->size += size;
+	return ret;
+}
+
+void arena_reset(Arena *arena) {
+	arena->current = arena->head;
+	arena->head->size = 0;
+}
+
+u64 arena_used(Arena *arena) {
+	u64 used = 0;
+	for (ArenaBlock *block = arena->head; block != arena->current; block = block->next) {
+		used += block->size;
+	}
+	return used + arena->current->size;
+}
+
+void arena_free(Arena *arena) {
+	ArenaBlock *block = arena->head;
+	while (block) {
+		ArenaBlock *next = block->next;
+		free(block->data);
+		free(block);
+		block = next;
+	}
+	free(arena);
+}
+
+void *mem_alloc(Arena *arena, u64 size) {
+	if (arena) {
+		return arena_alloc(arena, size);
+	}
+	return malloc(size);
+}
+
+void *mem_calloc(Arena *arena, u64 count, u64 size) {
+	if (arena) {
+		void *ret = arena_alloc(arena, count * size);
+		memset(ret, 0, count * size);
+		return ret;
+	}
+	return calloc(count, size);
+}
+
+void *mem_realloc(Arena *arena, void *ptr, u64 old_size, u64 new_size) {
+	if (arena) {
+		void *ret = arena_alloc(arena, new_size);
+		if (ptr) {
+			memcpy(ret, ptr, (old_size < new_size) ? old_size : new_size);
+		}
+		return ret;
+	}
+	return realloc(ptr, new_size);
+}
+
+char *mem_strndup(Arena *arena, char *str, u64 len) {
+	char *ret = (char *)mem_alloc(arena, len + 1);
+	memcpy(ret, str, len);
+	ret[len] = 0;
+	return ret;
+}
+
+char *mem_strdup(Arena *arena, char *str) {
+	return mem_strndup(arena, str, strlen(str));
+}
+
+void mem_free(Arena *arena, void *ptr) {
+	if (!arena) {
+		free(ptr);
+	}
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+#include "file_helper.h"
+#include "graph.h"
+#include "server.h"
+#include "pool.h"
+
+/*
+ * Routes a whole file of request lines (same JSON protocol as the server)
+ * across a worker pool. The graph is shared read-only; every worker owns a
+ * Server, i.e. its own SearchContext (frontier, costs and predecessors) and
+ * output buffer. Each line's response is recorded as a slice of its
+ * worker's buffer and the slices are written back in input order once the
+ * pool is done.
+ */
+
+#define BATCH_CHUNK 64
+
+typedef struct BatchLine {
+	char *line;
+	u64 len;
+	u32 worker;
+	u64 out_off;
+	u64 out_len;
+} BatchLine;
+
+typedef struct Batch {
+	Graph *g;
+	BatchLine *lines;
+	u64 line_count;
+	Server **workers;
+} Batch;
+
+static void batch_worker(void *ctx, u32 worker, u64 begin, u64 end) {
+	Batch *batch = (Batch *)ctx;
+	Server *s = batch->workers[worker];
+
+	for (u64 i = begin; i < end; i++) {
+		BatchLine *bl = &batch->lines[i];
+		u64 before = s->out->size;
+		handle_request(s, bl->line, bl->len);
+		bl->worker = worker;
+		bl->out_off = before;
+		bl->out_len = s->out->size - before;
+	}
+}
+
+static BatchLine *split_lines(File *file, u64 *count) {
+	u64 capacity = 1024;
+	BatchLine *lines = (BatchLine *)malloc(sizeof(BatchLine) * capacity);
+	*count = 0;
+
+	char *cursor = file->string;
+	char *end = file->string + file->size;
+	while (cursor < end) {
+		char *newline = (char *)memchr(cursor, '\n', end - cursor);
+		if (newline == NULL) {
+			newline = end;
+		}
+		if (!is_blank_line(cursor, newline - cursor)) {
+			if (*count == capacity) {
+				capacity *= 2;
+				lines = (BatchLine *)realloc(lines, sizeof(BatchLine) * capacity);
+			}
+			lines[*count].line = cursor;
+			lines[*count].len = newline - cursor;
+			(*count)++;
+		}
+		cursor = newline + 1;
+	}
+	return lines;
+}
+
+int run_batch(Graph *g, SearchOptions *opts, char *path, u32 thread_count) {
+	File *file = map_file(path);
+	if (file == NULL) {
+		return 1;
+	}
+
+	Batch batch;
+	batch.g = g;
+	batch.lines = split_lines(file, &batch.line_count);
+	batch.workers = (Server **)malloc(sizeof(Server *) * thread_count);
+	for (u32 i = 0; i < thread_count; i++) {
+		batch.workers[i] = server_init(g, opts);
+	}
+
+	WorkerPool *pool = pool_init(thread_count);
+	u64 start = get_time_ms();
+	pool_run(pool, batch_worker, &batch, batch.line_count, BATCH_CHUNK);
+	u64 elapsed = get_time_ms() - start;
+	pool_free(pool);
+
+	StrBuf *out = sb_init();
+	bool ok = true;
+	for (u64 i = 0; i < batch.line_count && ok; i++) {
+		BatchLine *bl = &batch.lines[i];
+		sb_append(out, batch.workers[bl->worker]->out->buffer + bl->out_off, bl->out_len);
+		if (out->size > SERVER_READ_SIZE) {
+			ok = write_all(STDOUT_FILENO, out->buffer, out->size);
+			sb_clear(out);
+		}
+	}
+	if (ok && out->size > 0) {
+		ok = write_all(STDOUT_FILENO, out->buffer, out->size);
+	}
+
+	fprintf(stderr, "routed %llu queries on %u threads in %llu ms (%.0f queries/s)\n",
+		batch.line_count, thread_count, elapsed, batch.line_count / ((elapsed > 0 ? elapsed : 1) / 1000.0));
+	if (batch.workers[0]->search->cache != NULL) {
+		u64 hits = 0;
+		u64 misses = 0;
+		for (u32 i = 0; i < thread_count; i++) {
+			hits += batch.workers[i]->search->cache->hits;
+			misses += batch.workers[i]->search->cache->misses;
+		}
+		fprintf(stderr, "route cache: %llu hits, %llu misses (%.1f%% hit rate)\n", hits, misses, (hits + misses) ? (100.0 * hits) / (hits + misses) : 0.0);
+	}
+#ifdef TRAM_STATS
+	QueryStats total;
+	memset(&total, 0, sizeof(total));
+	for (u32 i = 0; i < thread_count; i++) {
+		stats_add(&total, &batch.workers[i]->stats);
+	}
+	sb_clear(out);
+	stats_write_json(out, &total);
+	fprintf(stderr, "counters: %.*s\n", (int)out->size, out->buffer);
+#endif
+
+	sb_free(out);
+	for (u32 i = 0; i < thread_count; i++) {
+		server_free(batch.workers[i]);
+	}
+	free(batch.workers);
+	free(batch.lines);
+	close_file(file);
+	return ok ? 0 : 1;
+}
+
+#endif
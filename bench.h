@@ -0,0 +1,76 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "common.h"
+#include "graph.h"
+#include "router.h"
+
+/*
+ * Times random station-pair queries one at a time and reports throughput
+ * and latency percentiles. Each query is timed with common_rdtsc; cycles
+ * are turned into microseconds using the wall clock over the whole run.
+ */
+
+static int bench_compare_cycles(const void *a, const void *b) {
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+static u64 bench_percentile(u64 *sorted, u32 count, f64 p) {
+	u64 i = (u64)(p * (count - 1) + 0.5);
+	return sorted[i];
+}
+
+void bench_queries(Graph *g, SearchOptions *opts, u32 queries, u64 seed) {
+	if (g->station_count == 0 || queries == 0) {
+		return;
+	}
+
+	SearchContext *ctx = search_init(g->node_count);
+	search_configure(ctx, opts);
+	u64 *cycles = (u64 *)malloc(sizeof(u64) * queries);
+	u64 rng = seed ? seed : 1;
+	u64 settled = 0;
+	u32 reached = 0;
+
+#ifdef TRAM_STATS
+	memset(&tram_stats, 0, sizeof(tram_stats));
+#endif
+	u64 start_ms = get_time_ms();
+	u64 start_cycles = common_rdtsc();
+	for (u32 q = 0; q < queries; q++) {
+		char *from = station_name(g, rng_next(&rng) % g->station_count);
+		char *to = station_name(g, rng_next(&rng) % g->station_count);
+		u64 before = common_rdtsc();
+		Route *route = find_best_route(g, ctx, from, to);
+		cycles[q] = common_rdtsc() - before;
+		settled += ctx->settled;
+		reached += route->path != NULL;
+	}
+	u64 total_cycles = common_rdtsc() - start_cycles;
+	u64 elapsed = get_time_ms() - start_ms;
+
+	qsort(cycles, queries, sizeof(u64), bench_compare_cycles);
+	f64 us_per_cycle = (total_cycles > 0) ? (elapsed * 1000.0) / total_cycles : 0;
+	u64 p50 = bench_percentile(cycles, queries, 0.50);
+	u64 p99 = bench_percentile(cycles, queries, 0.99);
+	u64 max = cycles[queries - 1];
+
+	printf("  queries:     %u in %llu ms, %.0f queries/s, %u reached, %.1f nodes settled/query\n",
+		queries, elapsed, queries / ((elapsed > 0 ? elapsed : 1) / 1000.0), reached, (f64)settled / queries);
+	printf("  latency:     p50 %llu cycles (%.1f us), p99 %llu cycles (%.1f us), max %llu cycles (%.1f us)\n",
+		p50, p50 * us_per_cycle, p99, p99 * us_per_cycle, max, max * us_per_cycle);
+
+#ifdef TRAM_STATS
+	StrBuf *out = sb_init();
+	stats_write_json(out, &tram_stats);
+	printf("  counters:    %.*s\n", (int)out->size, out->buffer);
+	sb_free(out);
+#endif
+
+	free(cycles);
+	search_free(ctx);
+}
+
+#endif
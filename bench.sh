@@ -0,0 +1,15 @@
+# Scaling benchmark: generated networks of growing size, one bench run each.
+# usage: sh bench.sh [queries [sizes...]], extra routing options via BENCH_OPTS,
+# compiler via CC
+${CC:-cc} -O3 -pthread main.c -o tram_paths || exit 1
+queries=${1:-1000}
+[ $# -gt 0 ] && shift
+sizes=${*:-10000 100000 1000000}
+dir=$(mktemp -d)
+for n in $sizes; do
+	for kind in grid radial random; do
+		./tram_paths generate $kind $n "$dir/$kind-$n.log" || exit 1
+		(cd "$dir" && "$OLDPWD/tram_paths" $BENCH_OPTS bench --queries $queries "$kind-$n.log")
+	done
+done
+rm -rf "$dir"
@@ -0,0 +1,374 @@
+#include "hashmap.h"
+#include "stdlib.h"
+#include "assert.h"
+
+/*
+ * Sweeps the HashMap over key sets, hash functions, initial capacities and
+ * growth thresholds, reporting ns/op for insert, hit, miss and remove plus
+ * the probe distance histogram right after the inserts, then compares the
+ * worst single insert of a growing map with and without incremental growth.
+ *
+ *   bench_map [keys] [set] [hash]
+ *
+ * set and hash restrict the sweep to one entry by name. The "collide" set
+ * is built so every key has the same shift/xor hash (the one the map used
+ * to ship with); it is kept small, since a fully colliding set makes each
+ * insert walk the whole run.
+ */
+
+#define BENCH_COLLIDE_MAX 4096
+#define BENCH_HISTOGRAM 8
+
+typedef struct BenchKeys {
+	char *name;
+	char **keys;
+	u64 *lens;
+	// absent keys of the same shape, for misses
+	char **missing;
+	u64 count;
+} BenchKeys;
+
+typedef struct BenchHash {
+	char *name;
+	HMHashFn fn;
+} BenchHash;
+
+static u64 bench_now_ns() {
+	struct timespec tms;
+	clock_gettime(CLOCK_MONOTONIC, &tms);
+	return (u64)tms.tv_sec * 1000000000ull + tms.tv_nsec;
+}
+
+// What hm_hash replaced
+static u32 hash_shift_xor(char *key, u64 len) {
+	u64 hash = 0;
+	for (u64 i = 0; i < len; i++) {
+		hash = (hash << 4) ^ (hash >> 28) ^ (u8)key[i];
+	}
+	return ((u32)(hash ^ (hash >> 32))) | 1;
+}
+
+static u32 hash_fnv1a(char *key, u64 len) {
+	u64 hash = 0xcbf29ce484222325ull;
+	for (u64 i = 0; i < len; i++) {
+		hash ^= (u8)key[i];
+		hash *= 0x100000001b3ull;
+	}
+	return ((u32)(hash ^ (hash >> 32))) | 1;
+}
+
+static inline u32 bench_rotl32(u32 x, u32 r) {
+	return (x << r) | (x >> (32 - r));
+}
+
+// xxHash32, seed 0
+static u32 hash_xxh32(char *key, u64 len) {
+	const u32 p1 = 0x9e3779b1u, p2 = 0x85ebca77u, p3 = 0xc2b2ae3du, p4 = 0x27d4eb2fu, p5 = 0x165667b1u;
+	u8 *p = (u8 *)key;
+	u8 *end = p + len;
+	u32 hash;
+
+	if (len >= 16) {
+		u32 v[4] = { p1 + p2, p2, 0, 0 - p1 };
+		for (; p + 16 <= end; p += 16) {
+			for (u32 i = 0; i < 4; i++) {
+				u32 lane;
+				memcpy(&lane, p + i * 4, sizeof(lane));
+				v[i] = bench_rotl32(v[i] + lane * p2, 13) * p1;
+			}
+		}
+		hash = bench_rotl32(v[0], 1) + bench_rotl32(v[1], 7) + bench_rotl32(v[2], 12) + bench_rotl32(v[3], 18);
+	} else {
+		hash = p5;
+	}
+	hash += (u32)len;
+
+	for (; p + 4 <= end; p += 4) {
+		u32 lane;
+		memcpy(&lane, p, sizeof(lane));
+		hash = bench_rotl32(hash + lane * p3, 17) * p4;
+	}
+	for (; p < end; p++) {
+		hash = bench_rotl32(hash + *p * p5, 11) * p1;
+	}
+
+	hash ^= hash >> 15;
+	hash *= p2;
+	hash ^= hash >> 13;
+	hash *= p3;
+	hash ^= hash >> 16;
+	return hash | 1;
+}
+
+static BenchHash bench_hashes[] = {
+	{ "wyhash", hm_hash },
+	{ "shift_xor", hash_shift_xor },
+	{ "fnv1a", hash_fnv1a },
+	{ "xxh32", hash_xxh32 },
+};
+
+static char *bench_words[] = {
+	"North", "South", "Park", "Bridge", "Market", "Church", "Harbour", "Mill",
+	"Castle", "Green", "Station", "Road", "Hill", "Cross", "Gate", "Field",
+};
+
+static void bench_add_key(BenchKeys *set, u64 i, char *key, char *missing) {
+	set->keys[i] = strdup(key);
+	set->lens[i] = strlen(key);
+	set->missing[i] = strdup(missing);
+}
+
+static BenchKeys bench_alloc_keys(char *name, u64 count) {
+	BenchKeys set;
+	set.name = name;
+	set.count = count;
+	set.keys = (char **)malloc(sizeof(char *) * count);
+	set.lens = (u64 *)malloc(sizeof(u64) * count);
+	set.missing = (char **)malloc(sizeof(char *) * count);
+	return set;
+}
+
+// The baseline from test_hashmap.c
+static BenchKeys bench_toast_keys(u64 count) {
+	BenchKeys set = bench_alloc_keys("toast", count);
+	char key[32], missing[32];
+	for (u64 i = 0; i < count; i++) {
+		sprintf(key, "toast-%llu", i);
+		sprintf(missing, "toast-%llu", i + count);
+		bench_add_key(&set, i, key, missing);
+	}
+	return set;
+}
+
+// Shaped like graph node keys, "Station Name~LINE"
+static BenchKeys bench_platform_keys(u64 count) {
+	BenchKeys set = bench_alloc_keys("platform", count);
+	char key[64], missing[64];
+	for (u64 i = 0; i < count; i++) {
+		u64 station = i / 4;
+		char *a = bench_words[station % 16];
+		char *b = bench_words[(station / 16) % 16];
+		sprintf(key, "%s %s %llu~L%llu", a, b, station / 256, i % 4);
+		sprintf(missing, "%s %s %llu~M%llu", a, b, station / 256, i % 4);
+		bench_add_key(&set, i, key, missing);
+	}
+	return set;
+}
+
+// 40 to 100 bytes, all stored in the key arena
+static BenchKeys bench_long_keys(u64 count) {
+	BenchKeys set = bench_alloc_keys("long", count);
+	char key[160], missing[160];
+	u64 rng = 7;
+	for (u64 i = 0; i < count; i++) {
+		u64 len = 0;
+		u64 target = 40 + rng_next(&rng) % 60;
+		while (len < target) {
+			len += sprintf(key + len, "%s ", bench_words[rng_next(&rng) % 16]);
+		}
+		sprintf(key + len, "%llu", i);
+		memcpy(missing, key, len);
+		sprintf(missing + len, "x%llu", i);
+		bench_add_key(&set, i, key, missing);
+	}
+	return set;
+}
+
+/*
+ * Under shift/xor a byte pair (c1, c2) only contributes (c1 << 4) ^ c2, so
+ * every pair with the same value of that is interchangeable. Keys made of
+ * blocks of such pairs all hash alike.
+ */
+static BenchKeys bench_collide_keys(u64 count) {
+	char pairs[16][2];
+	u32 pair_count = 0;
+	for (u32 n = 0; n < 16; n++) {
+		u32 c2 = 0x41 ^ (n << 4);
+		if (c2 >= 0x21 && c2 <= 0x7e) {
+			pairs[pair_count][0] = (char)(0x40 | n);
+			pairs[pair_count][1] = (char)c2;
+			pair_count++;
+		}
+	}
+
+	if (count > BENCH_COLLIDE_MAX) {
+		count = BENCH_COLLIDE_MAX;
+	}
+	u32 blocks = 1;
+	for (u64 reach = pair_count; reach < count * 2; reach *= pair_count) {
+		blocks++;
+	}
+	BenchKeys set = bench_alloc_keys("collide", count);
+	char key[64], missing[64];
+	for (u64 i = 0; i < count; i++) {
+		// the odd indices are the misses, so they collide too
+		u64 k = i * 2;
+		u64 m = i * 2 + 1;
+		for (u32 b = 0; b < blocks; b++) {
+			memcpy(key + b * 2, pairs[k % pair_count], 2);
+			memcpy(missing + b * 2, pairs[m % pair_count], 2);
+			k /= pair_count;
+			m /= pair_count;
+		}
+		key[blocks * 2] = 0;
+		missing[blocks * 2] = 0;
+		bench_add_key(&set, i, key, missing);
+	}
+	assert(hash_shift_xor(set.keys[0], set.lens[0]) == hash_shift_xor(set.keys[count - 1], set.lens[count - 1]));
+	return set;
+}
+
+static void bench_free_keys(BenchKeys *set) {
+	for (u64 i = 0; i < set->count; i++) {
+		free(set->keys[i]);
+		free(set->missing[i]);
+	}
+	free(set->keys);
+	free(set->lens);
+	free(set->missing);
+}
+
+// Slots per probe distance 0, 1, 2, 3, 4-7, 8-15, 16-31, 32+
+static void bench_histogram(HashMap *hm, u64 *histogram, u64 *max_dist) {
+	memset(histogram, 0, sizeof(u64) * BENCH_HISTOGRAM);
+	*max_dist = 0;
+	for (u64 i = 0; i < hm->capacity; i++) {
+		if (hm->map[i].hash == HM_EMPTY) {
+			continue;
+		}
+		u64 dist = hm_probe_dist(hm, hm->map[i].hash, i);
+		u32 bucket = (dist < 4) ? dist : (dist < 8) ? 4 : (dist < 16) ? 5 : (dist < 32) ? 6 : 7;
+		histogram[bucket]++;
+		if (dist > *max_dist) {
+			*max_dist = dist;
+		}
+	}
+}
+
+static void bench_run(BenchKeys *set, BenchHash *hash, u64 capacity, u32 max_load) {
+	HashMap *map = hm_sized_init(capacity);
+	hm_set_max_load(map, max_load);
+	hm_set_hash(map, hash->fn);
+	u64 n = set->count;
+
+	u64 start = bench_now_ns();
+	for (u64 i = 0; i < n; i++) {
+		hm_insertn(&map, set->keys[i], set->lens[i], set->keys[i]);
+	}
+	u64 insert_ns = bench_now_ns() - start;
+	assert(map->size == n);
+
+	u64 histogram[BENCH_HISTOGRAM];
+	u64 max_dist;
+	bench_histogram(map, histogram, &max_dist);
+
+	start = bench_now_ns();
+	for (u64 i = 0; i < n; i++) {
+		void *result = hm_getn(map, set->keys[i], set->lens[i]);
+		assert(result == set->keys[i]);
+	}
+	u64 hit_ns = bench_now_ns() - start;
+
+	start = bench_now_ns();
+	for (u64 i = 0; i < n; i++) {
+		void *result = hm_get(map, set->missing[i]);
+		assert(result == NULL);
+	}
+	u64 miss_ns = bench_now_ns() - start;
+
+	start = bench_now_ns();
+	for (u64 i = 0; i < n; i++) {
+		bool ret = hm_removen(map, set->keys[i], set->lens[i]);
+		assert(ret);
+	}
+	u64 remove_ns = bench_now_ns() - start;
+	assert(map->size == 0);
+
+	u64 final_capacity = map->capacity;
+	hm_free(map);
+
+	printf("%-9s %-10s %9llu %4u%% %9llu %8.1f %8.1f %8.1f %8.1f %5llu ",
+		set->name, hash->name, capacity, max_load, final_capacity,
+		(f64)insert_ns / n, (f64)hit_ns / n, (f64)miss_ns / n, (f64)remove_ns / n, max_dist);
+	for (u32 b = 0; b < BENCH_HISTOGRAM; b++) {
+		printf(" %5.1f", 100.0 * histogram[b] / n);
+	}
+	printf("\n");
+}
+
+static int bench_compare_ns(const void *a, const void *b) {
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+// Per-insert latency while growing from the minimum, the cost a regrow lands on one call
+static void bench_growth(BenchKeys *set, bool incremental) {
+	HashMap *map = hm_init();
+	hm_set_incremental(map, incremental);
+	u64 n = set->count;
+	u64 *latency = (u64 *)malloc(sizeof(u64) * n);
+
+	u64 start = bench_now_ns();
+	for (u64 i = 0; i < n; i++) {
+		u64 before = bench_now_ns();
+		hm_insertn(&map, set->keys[i], set->lens[i], set->keys[i]);
+		latency[i] = bench_now_ns() - before;
+	}
+	u64 total = bench_now_ns() - start;
+	hm_free(map);
+
+	qsort(latency, n, sizeof(u64), bench_compare_ns);
+	printf("%-9s %-12s %8.1f %9llu %9llu %9llu\n", set->name, incremental ? "incremental" : "all at once",
+		(f64)total / n, latency[n / 2], latency[(u64)(n * 0.999)], latency[n - 1]);
+	free(latency);
+}
+
+int main(int argc, char **argv) {
+	u64 count = (argc > 1) ? strtoull(argv[1], NULL, 10) : 200000;
+	char *only_set = (argc > 2) ? argv[2] : NULL;
+	char *only_hash = (argc > 3) ? argv[3] : NULL;
+	if (count < 2) {
+		count = 2;
+	}
+
+	BenchKeys sets[] = {
+		bench_toast_keys(count),
+		bench_platform_keys(count),
+		bench_long_keys(count),
+		bench_collide_keys(count),
+	};
+	u32 loads[] = { 50, 75, 90 };
+
+	printf("%-9s %-10s %9s %5s %9s %8s %8s %8s %8s %5s  probe distance %% of keys: 0 1 2 3 4-7 8-15 16-31 32+\n",
+		"keys", "hash", "init_cap", "load", "end_cap", "insert", "hit", "miss", "remove", "max");
+	for (u32 s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+		BenchKeys *set = &sets[s];
+		if (only_set != NULL && strcmp(only_set, set->name)) {
+			continue;
+		}
+		for (u32 h = 0; h < sizeof(bench_hashes) / sizeof(bench_hashes[0]); h++) {
+			if (only_hash != NULL && strcmp(only_hash, bench_hashes[h].name)) {
+				continue;
+			}
+			for (u32 l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+				// growing from the minimum, then presized to stay under the threshold
+				bench_run(set, &bench_hashes[h], 1, loads[l]);
+				bench_run(set, &bench_hashes[h], set->count * 100 / loads[l] + 1, loads[l]);
+			}
+		}
+	}
+
+	printf("\n%-9s %-12s %8s %9s %9s %9s\n", "keys", "growth", "ns/op", "p50", "p99.9", "max");
+	for (u32 s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+		if (only_set != NULL && strcmp(only_set, sets[s].name)) {
+			continue;
+		}
+		bench_growth(&sets[s], false);
+		bench_growth(&sets[s], true);
+	}
+
+	for (u32 s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+		bench_free_keys(&sets[s]);
+	}
+}
@@ -1,2 +1,5 @@
-clang -O3 main.c -o tram_paths
+clang -O3 -pthread main.c -o tram_paths
 clang -O3 -g test_hashmap.c -o test_map
+clang -O3 -g test_pqueue.c -o test_pq
+clang -O3 bench_hashmap.c -o bench_map
+# counters build: clang -O3 -pthread -DTRAM_STATS main.c -o tram_paths_stats
@@ -0,0 +1,157 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "common.h"
+#include "hashmap.h"
+
+/*
+ * LRU cache of finished routes keyed by (start station, end station).
+ * Entries hold the trip time and the platform path, which also names the
+ * line of every leg, in one allocation; the HashMap finds them and a
+ * doubly linked list keeps them in recency order. Least recent entries are
+ * evicted once the bytes held exceed the budget. The whole cache is dropped
+ * when a query runs against a newer version of the edge times. A cache
+ * belongs to one SearchContext, so it needs no locking.
+ */
+
+typedef struct CacheEntry {
+	struct CacheEntry *prev;
+	struct CacheEntry *next;
+	u32 key[2];
+	f32 time;
+	u32 path_size;
+	u32 path[];
+} CacheEntry;
+
+typedef struct RouteCache {
+	HashMap *entries;
+	// most recently used first
+	CacheEntry *head;
+	CacheEntry *tail;
+	u64 bytes;
+	u64 budget;
+	u64 version;
+
+	u64 hits;
+	u64 misses;
+	u64 evictions;
+	u64 invalidations;
+} RouteCache;
+
+RouteCache *cache_init(u64 budget) {
+	RouteCache *cache = (RouteCache *)calloc(1, sizeof(RouteCache));
+	cache->entries = hm_init();
+	// the server inserts on the query path, so don't stall one query on a regrow
+	hm_set_incremental(cache->entries, true);
+	cache->budget = budget;
+	return cache;
+}
+
+static u64 cache_entry_size(u32 path_size) {
+	return sizeof(CacheEntry) + (sizeof(u32) * path_size) + sizeof(HMNode);
+}
+
+static void cache_unlink(RouteCache *cache, CacheEntry *entry) {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+}
+
+static void cache_push_front(RouteCache *cache, CacheEntry *entry) {
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+	cache->head = entry;
+}
+
+static void cache_drop(RouteCache *cache, CacheEntry *entry) {
+	cache_unlink(cache, entry);
+	hm_removen(cache->entries, (char *)entry->key, sizeof(entry->key));
+	cache->bytes -= cache_entry_size(entry->path_size);
+	free(entry);
+}
+
+void cache_clear(RouteCache *cache) {
+	while (cache->head) {
+		cache_drop(cache, cache->head);
+	}
+}
+
+// Clears the cache if it was filled from another version of the edge times
+static void cache_check_version(RouteCache *cache, u64 version) {
+	if (cache->version != version) {
+		if (cache->head) {
+			cache->invalidations++;
+		}
+		cache_clear(cache);
+		cache->version = version;
+	}
+}
+
+CacheEntry *cache_get(RouteCache *cache, u64 version, u32 start_station, u32 end_station) {
+	cache_check_version(cache, version);
+
+	u32 key[2] = { start_station, end_station };
+	CacheEntry *entry = (CacheEntry *)hm_getn(cache->entries, (char *)key, sizeof(key));
+	if (entry == NULL) {
+		cache->misses++;
+		return NULL;
+	}
+
+	cache->hits++;
+	if (entry != cache->head) {
+		cache_unlink(cache, entry);
+		cache_push_front(cache, entry);
+	}
+	return entry;
+}
+
+void cache_put(RouteCache *cache, u64 version, u32 start_station, u32 end_station, f32 time, u32 *path, u32 path_size) {
+	cache_check_version(cache, version);
+
+	u64 size = cache_entry_size(path_size);
+	if (size > cache->budget) {
+		return;
+	}
+	while (cache->bytes + size > cache->budget && cache->tail) {
+		cache_drop(cache, cache->tail);
+		cache->evictions++;
+	}
+
+	CacheEntry *entry = (CacheEntry *)malloc(sizeof(CacheEntry) + (sizeof(u32) * path_size));
+	entry->key[0] = start_station;
+	entry->key[1] = end_station;
+	entry->time = time;
+	entry->path_size = path_size;
+	if (path_size > 0) {
+		memcpy(entry->path, path, sizeof(u32) * path_size);
+	}
+
+	hm_insertn(&cache->entries, (char *)entry->key, sizeof(entry->key), entry);
+	cache_push_front(cache, entry);
+	cache->bytes += size;
+}
+
+f64 cache_hit_rate(RouteCache *cache) {
+	u64 lookups = cache->hits + cache->misses;
+	return lookups ? (f64)cache->hits / lookups : 0;
+}
+
+void cache_free(RouteCache *cache) {
+	cache_clear(cache);
+	hm_free(cache->entries);
+	free(cache);
+}
+
+#endif
@@ -52,6 +52,16 @@ u64 common_rdtsc() {
 }
 #endif
 
+// xorshift64*, good enough for picking landmarks and generating test networks
+u64 rng_next(u64 *state) {
+	u64 x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
 u64 get_time_ms() {
     struct timespec tms;
 	clock_gettime(CLOCK_MONOTONIC, &tms);
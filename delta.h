@@ -0,0 +1,315 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <math.h>
+
+#include "common.h"
+#include "graph.h"
+#include "pool.h"
+
+/*
+ * Delta-stepping: a shortest path search that settles a whole band of
+ * costs at once so the work in a band can be split across threads. Bucket
+ * i holds platforms whose tentative cost lies in [i * width, (i + 1) *
+ * width). The lowest non-empty bucket is emptied repeatedly, relaxing only
+ * light edges (time <= width) since those are the only ones that can land
+ * back in it, until it stays empty; its platforms are then final and their
+ * heavy edges are relaxed once. Edges of one pass are relaxed in parallel.
+ *
+ * A platform's cost and predecessor are packed into one u64 label, cost
+ * bits on top, and lowered with a compare and swap. Non-negative floats
+ * order the same as their bit patterns, so a plain integer comparison of
+ * the top half decides, and a label always names the predecessor platform
+ * whose relaxation produced its cost. Workers note every platform they
+ * lower; the notes are filed into buckets between passes on the calling
+ * thread. Passes too small to be worth waking the pool for run inline.
+ *
+ * A small width approaches Dijkstra (little parallel work per bucket), a
+ * large one approaches Bellman-Ford (many re-relaxations); 0 picks the mean
+ * edge time.
+ */
+
+#define DELTA_PARALLEL_MIN 512
+#define DELTA_CHUNK 64
+#define DELTA_UNREACHED (((u64)0x7f800000 << 32) | NO_NODE)
+
+typedef struct DeltaList {
+	u32 *items;
+	u64 size;
+	u64 capacity;
+} DeltaList;
+
+typedef struct DeltaStepping {
+	f32 width;
+	u32 thread_count;
+	// NULL when running on one thread
+	WorkerPool *pool;
+
+	u32 node_capacity;
+	u64 *labels;
+	// a platform is in the current pass when seen matches seen_stamp, and
+	// among the current bucket's settled platforms when removed matches removed_stamp
+	u32 *seen;
+	u32 *removed;
+	u32 seen_stamp;
+	u32 removed_stamp;
+
+	DeltaList *buckets;
+	u64 bucket_count;
+	u64 bucket_used;
+	DeltaList frontier;
+	DeltaList settled_list;
+	// platforms each worker lowered during the current pass
+	DeltaList *touched;
+	// per worker counters, see stats.h
+	QueryStats *stats;
+
+	// state of the running pass
+	Graph *g;
+	f32 *times;
+	DeltaList *pass;
+	bool heavy;
+
+	// platforms taken from buckets and light passes run by the last search
+	u64 settled;
+	u64 passes;
+} DeltaStepping;
+
+static inline void delta_list_push(DeltaList *list, u32 item) {
+	if (list->size == list->capacity) {
+		list->capacity = (list->capacity > 0) ? list->capacity * 2 : 64;
+		list->items = (u32 *)realloc(list->items, sizeof(u32) * list->capacity);
+	}
+	list->items[list->size++] = item;
+}
+
+static inline f32 delta_label_cost(u64 label) {
+	u32 bits = (u32)(label >> 32);
+	f32 cost;
+	memcpy(&cost, &bits, sizeof(cost));
+	return cost;
+}
+
+static inline u64 delta_label(f32 cost, u32 from) {
+	u32 bits;
+	memcpy(&bits, &cost, sizeof(bits));
+	return ((u64)bits << 32) | from;
+}
+
+static inline f32 delta_cost(DeltaStepping *ds, u32 node) {
+	return delta_label_cost(__atomic_load_n(&ds->labels[node], __ATOMIC_RELAXED));
+}
+
+static inline u32 delta_from(DeltaStepping *ds, u32 node) {
+	return (u32)ds->labels[node];
+}
+
+// Mean finite edge time, the default bucket width
+f32 delta_auto_width(Graph *g, f32 *times) {
+	f64 sum = 0;
+	u64 count = 0;
+	for (u32 e = 0; e < g->edge_count; e++) {
+		if (times[e] < INFINITY) {
+			sum += times[e];
+			count++;
+		}
+	}
+	return (count > 0 && sum > 0) ? (f32)(sum / count) : 1.0f;
+}
+
+DeltaStepping *delta_init(u32 node_count, f32 width, u32 thread_count) {
+	DeltaStepping *ds = (DeltaStepping *)calloc(1, sizeof(DeltaStepping));
+	ds->width = width;
+	ds->thread_count = (thread_count > 0) ? thread_count : 1;
+	ds->pool = (ds->thread_count > 1) ? pool_init(ds->thread_count) : NULL;
+	ds->node_capacity = node_count;
+	ds->labels = (u64 *)malloc(sizeof(u64) * (node_count + 1));
+	ds->seen = (u32 *)calloc(node_count + 1, sizeof(u32));
+	ds->removed = (u32 *)calloc(node_count + 1, sizeof(u32));
+	ds->touched = (DeltaList *)calloc(ds->thread_count, sizeof(DeltaList));
+	ds->stats = (QueryStats *)calloc(ds->thread_count, sizeof(QueryStats));
+	return ds;
+}
+
+void delta_free(DeltaStepping *ds) {
+	if (ds->pool != NULL) {
+		pool_free(ds->pool);
+	}
+	for (u64 i = 0; i < ds->bucket_count; i++) {
+		free(ds->buckets[i].items);
+	}
+	for (u32 i = 0; i < ds->thread_count; i++) {
+		free(ds->touched[i].items);
+	}
+	free(ds->buckets);
+	free(ds->touched);
+	free(ds->stats);
+	free(ds->frontier.items);
+	free(ds->settled_list.items);
+	free(ds->labels);
+	free(ds->seen);
+	free(ds->removed);
+	free(ds);
+}
+
+static inline u64 delta_bucket(DeltaStepping *ds, f32 cost) {
+	return (u64)(cost / ds->width);
+}
+
+static void delta_bucket_add(DeltaStepping *ds, u64 bucket, u32 node) {
+	if (bucket >= ds->bucket_count) {
+		u64 count = (ds->bucket_count > 0) ? ds->bucket_count : 64;
+		while (count <= bucket) {
+			count *= 2;
+		}
+		ds->buckets = (DeltaList *)realloc(ds->buckets, sizeof(DeltaList) * count);
+		memset(ds->buckets + ds->bucket_count, 0, sizeof(DeltaList) * (count - ds->bucket_count));
+		ds->bucket_count = count;
+	}
+	if (bucket >= ds->bucket_used) {
+		ds->bucket_used = bucket + 1;
+	}
+	delta_list_push(&ds->buckets[bucket], node);
+}
+
+static void delta_relax_worker(void *arg, u32 worker, u64 begin, u64 end) {
+	DeltaStepping *ds = (DeltaStepping *)arg;
+	Graph *g = ds->g;
+	DeltaList *touched = &ds->touched[worker];
+	u32 *items = ds->pass->items;
+	STAT_MARK(mark);
+
+	for (u64 i = begin; i < end; i++) {
+		u32 current = items[i];
+		f32 current_cost = delta_cost(ds, current);
+		for (u32 e = g->edge_offsets[current]; e < g->edge_offsets[current + 1]; e++) {
+			f32 time = ds->times[e];
+			if ((time > ds->width) != ds->heavy) {
+				continue;
+			}
+			STAT_ADD(edges_relaxed, 1);
+			u32 next = g->edge_targets[e];
+			u64 label = delta_label(current_cost + time, current);
+			u64 old = __atomic_load_n(&ds->labels[next], __ATOMIC_RELAXED);
+			while ((label >> 32) < (old >> 32)) {
+				if (__atomic_compare_exchange_n(&ds->labels[next], &old, label, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					delta_list_push(touched, next);
+					break;
+				}
+			}
+		}
+	}
+	STAT_MOVE(&ds->stats[worker], mark);
+}
+
+// Relaxes the light or heavy edges of every platform in list, then files what moved
+static void delta_pass(DeltaStepping *ds, DeltaList *list, bool heavy) {
+	ds->pass = list;
+	ds->heavy = heavy;
+	if (ds->pool != NULL && list->size >= DELTA_PARALLEL_MIN) {
+		pool_run(ds->pool, delta_relax_worker, ds, list->size, DELTA_CHUNK);
+	} else {
+		delta_relax_worker(ds, 0, 0, list->size);
+	}
+	STAT_FOLD(ds->stats, ds->thread_count);
+
+	for (u32 w = 0; w < ds->thread_count; w++) {
+		DeltaList *touched = &ds->touched[w];
+		for (u64 i = 0; i < touched->size; i++) {
+			u32 node = touched->items[i];
+			delta_bucket_add(ds, delta_bucket(ds, delta_cost(ds, node)), node);
+		}
+		touched->size = 0;
+	}
+}
+
+static u32 delta_next_stamp(u32 *stamp, u32 *marks, u32 node_capacity) {
+	(*stamp)++;
+	if (*stamp == 0) {
+		memset(marks, 0, sizeof(u32) * (node_capacity + 1));
+		*stamp = 1;
+	}
+	return *stamp;
+}
+
+/*
+ * Searches from every platform in start_nodes at cost 0 using times. Stops
+ * once a bucket settles a platform of end_station and returns the cheapest
+ * such platform, or runs to exhaustion when end_station is NO_NODE. Costs
+ * and predecessors stay readable through delta_cost and delta_from.
+ */
+u32 delta_run(DeltaStepping *ds, Graph *g, f32 *times, u32 *start_nodes, u32 start_count, u32 end_station) {
+	if (g->node_count > ds->node_capacity) {
+		ds->node_capacity = g->node_count;
+		ds->labels = (u64 *)realloc(ds->labels, sizeof(u64) * (g->node_count + 1));
+		ds->seen = (u32 *)realloc(ds->seen, sizeof(u32) * (g->node_count + 1));
+		ds->removed = (u32 *)realloc(ds->removed, sizeof(u32) * (g->node_count + 1));
+		memset(ds->seen, 0, sizeof(u32) * (g->node_count + 1));
+		memset(ds->removed, 0, sizeof(u32) * (g->node_count + 1));
+		ds->seen_stamp = 0;
+		ds->removed_stamp = 0;
+	}
+	if (ds->width <= 0) {
+		ds->width = delta_auto_width(g, times);
+	}
+
+	ds->g = g;
+	ds->times = times;
+	ds->settled = 0;
+	ds->passes = 0;
+	for (u32 v = 0; v < g->node_count; v++) {
+		ds->labels[v] = DELTA_UNREACHED;
+	}
+	for (u64 i = 0; i < ds->bucket_used; i++) {
+		ds->buckets[i].size = 0;
+	}
+	ds->bucket_used = 0;
+	for (u32 i = 0; i < start_count; i++) {
+		ds->labels[start_nodes[i]] = delta_label(0.0f, NO_NODE);
+		delta_bucket_add(ds, 0, start_nodes[i]);
+	}
+
+	u32 end_node = NO_NODE;
+	for (u64 b = 0; b < ds->bucket_used && end_node == NO_NODE; b++) {
+		u32 removed_stamp = delta_next_stamp(&ds->removed_stamp, ds->removed, ds->node_capacity);
+		ds->settled_list.size = 0;
+
+		// Later passes may refill the bucket, so always reload it through ds->buckets
+		while (ds->buckets[b].size > 0) {
+			u32 seen_stamp = delta_next_stamp(&ds->seen_stamp, ds->seen, ds->node_capacity);
+			DeltaList *bucket = &ds->buckets[b];
+			ds->frontier.size = 0;
+			for (u64 i = 0; i < bucket->size; i++) {
+				u32 node = bucket->items[i];
+				if (ds->seen[node] == seen_stamp || delta_bucket(ds, delta_cost(ds, node)) != b) {
+					continue;
+				}
+				ds->seen[node] = seen_stamp;
+				delta_list_push(&ds->frontier, node);
+				if (ds->removed[node] != removed_stamp) {
+					ds->removed[node] = removed_stamp;
+					delta_list_push(&ds->settled_list, node);
+				}
+			}
+			bucket->size = 0;
+			ds->settled += ds->frontier.size;
+			ds->passes++;
+			delta_pass(ds, &ds->frontier, false);
+		}
+
+		delta_pass(ds, &ds->settled_list, true);
+
+		if (end_station != NO_NODE) {
+			for (u64 i = 0; i < ds->settled_list.size; i++) {
+				u32 node = ds->settled_list.items[i];
+				if (g->node_station[node] == end_station && (end_node == NO_NODE || delta_cost(ds, node) < delta_cost(ds, end_node))) {
+					end_node = node;
+				}
+			}
+		}
+	}
+
+	return end_node;
+}
+
+#endif
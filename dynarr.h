@@ -2,21 +2,29 @@
 #define DYNARR_H
 
 #include "common.h"
+#include "arena.h"
+#include "stats.h"
 
 typedef struct DynArr {
 	void **buffer;
 	u64 size;
 	u64 capacity;
+	Arena *arena;
 } DynArr;
 
-DynArr *da_sized_init(u64 capacity) {
-	DynArr *da = (DynArr *)malloc(sizeof(DynArr));
-	da->buffer = (void **)malloc(sizeof(void *) * capacity);
+DynArr *da_arena_init(Arena *arena, u64 capacity) {
+	DynArr *da = (DynArr *)mem_alloc(arena, sizeof(DynArr));
+	da->buffer = (void **)mem_alloc(arena, sizeof(void *) * capacity);
 	da->size = 0;
 	da->capacity = capacity;
+	da->arena = arena;
 	return da;
 }
 
+DynArr *da_sized_init(u64 capacity) {
+	return da_arena_init(NULL, capacity);
+}
+
 DynArr *da_init() {
 	return da_sized_init(1);
 }
@@ -25,8 +33,10 @@ bool da_insert(DynArr *da, void *data) {
 	if (data != NULL) {
 		if (da->capacity <= da->size) {
 			debug("[DA] growing capacity from %llu to %llu because size is %llu\n", da->capacity, da->size * 2, da->size);
+			STAT_ADD(array_reallocs, 1);
+			u64 old_capacity = da->capacity;
 			da->capacity = da->size * 2;
-			da->buffer = (void **)realloc(da->buffer, sizeof(void *) * da->capacity);
+			da->buffer = (void **)mem_realloc(da->arena, da->buffer, sizeof(void *) * old_capacity, sizeof(void *) * da->capacity);
 		}
 		da->buffer[da->size] = data;
 		da->size++;
@@ -42,16 +52,15 @@ void da_print(DynArr *da) {
 }
 
 void da_free(DynArr *da) {
-	free(da->buffer);
-	free(da);
+	mem_free(da->arena, da->buffer);
+	mem_free(da->arena, da);
 }
 
 void da_free_data(DynArr *da) {
 	for (u64 i = 0; i < da->size; i++) {
-		free(da->buffer[i]);
+		mem_free(da->arena, da->buffer[i]);
 	}
-	free(da->buffer);
-	free(da);
+	da_free(da);
 }
 
 #endif
@@ -3,10 +3,16 @@
 
 #include "common.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
 typedef struct File {
 	char *filename;
 	char *string;
 	u64 size;
+	bool mapped;
 } File;
 
 File *read_file(char *filename) {
@@ -31,10 +37,61 @@ File *read_file(char *filename) {
 	f->filename = filename;
 	f->string = file_string;
 	f->size = length;
+	f->mapped = false;
 
 	return f;
 }
 
+/*
+ * Maps the file read-only instead of copying it. The contents are not NUL
+ * terminated, so readers must stay within size.
+ */
+File *map_file(char *filename) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		printf("%s not found!\n", filename);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+
+	File *f = (File *)malloc(sizeof(File));
+	f->filename = filename;
+	f->size = st.st_size;
+	f->string = NULL;
+	f->mapped = true;
+
+	if (f->size > 0) {
+		void *addr = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			printf("failed to map %s!\n", filename);
+			close(fd);
+			free(f);
+			return NULL;
+		}
+		madvise(addr, f->size, MADV_SEQUENTIAL);
+		f->string = (char *)addr;
+	}
+
+	close(fd);
+	return f;
+}
+
+void close_file(File *f) {
+	if (f->mapped) {
+		if (f->size > 0) {
+			munmap(f->string, f->size);
+		}
+	} else {
+		free(f->string);
+	}
+	free(f);
+}
+
 char *file_to_string(const char *filename) {
 	FILE *file = fopen(filename, "r");
 
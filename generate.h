@@ -0,0 +1,377 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "common.h"
+
+/*
+ * Synthetic networks in stations.log format, for timing the router at sizes
+ * the real network never reaches. Three shapes:
+ *
+ *   grid     side x side stations, a line along every row and every column
+ *   radial   `lines` spokes out of one hub, crossed by ring lines every
+ *            GENERATE_RING_GAP stations
+ *   random   stations scattered over a square, lines each walking greedily
+ *            between two random points, starting from stations no line
+ *            serves yet; stations left unserved are not written
+ *
+ * Hop times are random (grid, radial) or follow distance (random), in half
+ * minutes. Every station served by several lines gets a transfer between
+ * each pair of them. The same seed always writes the same file.
+ */
+
+#define GENERATE_TRANSFER_TIME 3
+#define GENERATE_RING_GAP 8
+
+typedef enum GenerateKind {
+	GENERATE_GRID,
+	GENERATE_RADIAL,
+	GENERATE_RANDOM,
+} GenerateKind;
+
+typedef struct Generator {
+	GenerateKind kind;
+	FILE *out;
+	u64 rng;
+	// row length for grids, stations per spoke for radial networks
+	u32 span;
+	// radial line ids below this are spokes, the rest rings
+	u32 spokes;
+	// (station << 32 | line) for every stop written, to place transfers
+	u64 *stops;
+	u64 stop_count;
+	u64 stop_capacity;
+	u64 edge_count;
+	u32 station_count;
+} Generator;
+
+bool parse_generate_kind(char *name, GenerateKind *kind) {
+	if (!strcmp(name, "grid")) {
+		*kind = GENERATE_GRID;
+	} else if (!strcmp(name, "radial")) {
+		*kind = GENERATE_RADIAL;
+	} else if (!strcmp(name, "random")) {
+		*kind = GENERATE_RANDOM;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void generate_station_name(Generator *gen, u32 station, char *buffer, u64 size) {
+	if (gen->kind == GENERATE_GRID) {
+		snprintf(buffer, size, "S%u_%u", station / gen->span, station % gen->span);
+	} else if (gen->kind == GENERATE_RADIAL) {
+		if (station == 0) {
+			snprintf(buffer, size, "HUB");
+		} else {
+			snprintf(buffer, size, "P%u_%u", (station - 1) / gen->span, (station - 1) % gen->span + 1);
+		}
+	} else {
+		snprintf(buffer, size, "S%u", station);
+	}
+}
+
+// Grid lines are rows then columns; radial lines are spokes then rings
+static void generate_line_name(Generator *gen, u32 line, char *buffer, u64 size) {
+	if (gen->kind == GENERATE_GRID) {
+		snprintf(buffer, size, (line < gen->span) ? "R%u" : "C%u", line % gen->span);
+	} else if (gen->kind == GENERATE_RADIAL) {
+		snprintf(buffer, size, (line < gen->spokes) ? "L%u" : "O%u", (line < gen->spokes) ? line : line - gen->spokes);
+	} else {
+		snprintf(buffer, size, "L%u", line);
+	}
+}
+
+static void generate_stop(Generator *gen, u32 station, u32 line) {
+	if (gen->stop_count == gen->stop_capacity) {
+		gen->stop_capacity = (gen->stop_capacity > 0) ? gen->stop_capacity * 2 : 1024;
+		gen->stops = (u64 *)realloc(gen->stops, sizeof(u64) * gen->stop_capacity);
+	}
+	gen->stops[gen->stop_count++] = ((u64)station << 32) | line;
+}
+
+static void generate_edge(Generator *gen, u32 station1, u32 line1, u32 station2, u32 line2, f32 time) {
+	char names[4][32];
+	generate_station_name(gen, station1, names[0], sizeof(names[0]));
+	generate_line_name(gen, line1, names[1], sizeof(names[1]));
+	generate_station_name(gen, station2, names[2], sizeof(names[2]));
+	generate_line_name(gen, line2, names[3], sizeof(names[3]));
+	fprintf(gen->out, "%s, %s, %s, %s, %g\n", names[0], names[1], names[2], names[3], time);
+	gen->edge_count++;
+}
+
+// One hop of a line, recording both ends as stops
+static void generate_hop(Generator *gen, u32 line, u32 from, u32 to, f32 time) {
+	if (gen->stop_count == 0 || gen->stops[gen->stop_count - 1] != (((u64)from << 32) | line)) {
+		generate_stop(gen, from, line);
+	}
+	generate_stop(gen, to, line);
+	generate_edge(gen, from, line, to, line, time);
+}
+
+// The build links without libm, so square roots are done here
+static f32 generate_distance(f32 dx, f32 dy) {
+	f32 square = dx * dx + dy * dy;
+	if (square <= 0) {
+		return 0;
+	}
+	f32 root = (square > 1.0f) ? square : 1.0f;
+	for (u32 i = 0; i < 32; i++) {
+		f32 next = 0.5f * (root + square / root);
+		if (next >= root) {
+			break;
+		}
+		root = next;
+	}
+	return root;
+}
+
+static u32 generate_isqrt_ceil(u32 n) {
+	u32 root = 0;
+	while ((u64)root * root < n) {
+		root++;
+	}
+	return root;
+}
+
+static f32 generate_hop_time(Generator *gen) {
+	return 1.0f + (f32)(rng_next(&gen->rng) % 9) * 0.5f;
+}
+
+static int generate_compare_stops(const void *a, const void *b) {
+	u64 x = *(const u64 *)a;
+	u64 y = *(const u64 *)b;
+	return (x > y) - (x < y);
+}
+
+static void generate_transfers(Generator *gen) {
+	qsort(gen->stops, gen->stop_count, sizeof(u64), generate_compare_stops);
+	// A line that closes a loop, like a ring, records its first stop twice
+	u64 unique = 0;
+	for (u64 i = 0; i < gen->stop_count; i++) {
+		if (unique == 0 || gen->stops[unique - 1] != gen->stops[i]) {
+			gen->stops[unique++] = gen->stops[i];
+		}
+	}
+	gen->stop_count = unique;
+	u64 begin = 0;
+	while (begin < gen->stop_count) {
+		u32 station = (u32)(gen->stops[begin] >> 32);
+		u64 end = begin;
+		while (end < gen->stop_count && (u32)(gen->stops[end] >> 32) == station) {
+			end++;
+		}
+		gen->station_count++;
+		for (u64 i = begin; i < end; i++) {
+			for (u64 j = i + 1; j < end; j++) {
+				u32 line1 = (u32)gen->stops[i];
+				u32 line2 = (u32)gen->stops[j];
+				if (line1 != line2) {
+					generate_edge(gen, station, line1, station, line2, GENERATE_TRANSFER_TIME);
+				}
+			}
+		}
+		begin = end;
+	}
+}
+
+static void generate_grid(Generator *gen, u32 stations) {
+	u32 side = generate_isqrt_ceil(stations);
+	side = (side > 1) ? side : 2;
+	gen->span = side;
+	for (u32 r = 0; r < side; r++) {
+		for (u32 c = 0; c + 1 < side; c++) {
+			generate_hop(gen, r, r * side + c, r * side + c + 1, generate_hop_time(gen));
+		}
+	}
+	for (u32 c = 0; c < side; c++) {
+		for (u32 r = 0; r + 1 < side; r++) {
+			generate_hop(gen, side + c, r * side + c, (r + 1) * side + c, generate_hop_time(gen));
+		}
+	}
+}
+
+static void generate_radial(Generator *gen, u32 stations, u32 lines) {
+	u32 spokes = (lines > 0) ? lines : 8;
+	u32 length = (stations > spokes) ? (stations - 1) / spokes : 1;
+	// station 1 + s * length + (j - 1) is stop j of spoke s
+	gen->span = length;
+	gen->spokes = spokes;
+	for (u32 s = 0; s < spokes; s++) {
+		u32 previous = 0;
+		for (u32 j = 1; j <= length; j++) {
+			u32 station = 1 + s * length + (j - 1);
+			generate_hop(gen, s, previous, station, generate_hop_time(gen));
+			previous = station;
+		}
+	}
+
+	u32 ring = 0;
+	for (u32 j = GENERATE_RING_GAP; j <= length && spokes > 2; j += GENERATE_RING_GAP, ring++) {
+		u32 line = spokes + ring;
+		for (u32 s = 0; s < spokes; s++) {
+			u32 from = 1 + s * length + (j - 1);
+			u32 to = 1 + ((s + 1) % spokes) * length + (j - 1);
+			generate_hop(gen, line, from, to, generate_hop_time(gen) + (f32)(j / GENERATE_RING_GAP));
+		}
+	}
+}
+
+typedef struct GeneratePoint {
+	f32 x;
+	f32 y;
+} GeneratePoint;
+
+static void generate_random(Generator *gen, u32 stations, u32 lines) {
+	u32 cells = generate_isqrt_ceil((stations + 1) / 2);
+	cells = (cells > 0) ? cells : 1;
+	gen->span = 0;
+
+	// Points bucketed into a cells x cells grid so neighbours are found locally
+	GeneratePoint *points = (GeneratePoint *)malloc(sizeof(GeneratePoint) * stations);
+	u32 *cell_offsets = (u32 *)calloc((u64)cells * cells + 1, sizeof(u32));
+	u32 *cell_of = (u32 *)malloc(sizeof(u32) * stations);
+	for (u32 i = 0; i < stations; i++) {
+		points[i].x = (f32)((rng_next(&gen->rng) >> 11) * (1.0 / 9007199254740992.0)) * cells;
+		points[i].y = (f32)((rng_next(&gen->rng) >> 11) * (1.0 / 9007199254740992.0)) * cells;
+		points[i].x = (points[i].x < cells) ? points[i].x : (f32)cells * 0.99999f;
+		points[i].y = (points[i].y < cells) ? points[i].y : (f32)cells * 0.99999f;
+		cell_of[i] = (u32)points[i].y * cells + (u32)points[i].x;
+		cell_offsets[cell_of[i] + 1]++;
+	}
+	for (u64 c = 0; c < (u64)cells * cells; c++) {
+		cell_offsets[c + 1] += cell_offsets[c];
+	}
+	u32 *cell_points = (u32 *)malloc(sizeof(u32) * stations);
+	u32 *fill = (u32 *)malloc(sizeof(u32) * ((u64)cells * cells + 1));
+	memcpy(fill, cell_offsets, sizeof(u32) * ((u64)cells * cells + 1));
+	for (u32 i = 0; i < stations; i++) {
+		cell_points[fill[cell_of[i]]++] = i;
+	}
+
+	// Lines start from uncovered stations in a random order
+	u32 *order = (u32 *)malloc(sizeof(u32) * stations);
+	for (u32 i = 0; i < stations; i++) {
+		order[i] = i;
+	}
+	for (u32 i = stations - 1; i > 0; i--) {
+		u32 j = (u32)(rng_next(&gen->rng) % (i + 1));
+		u32 t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	// visited[i] == line + 1 while line is being walked, so no line loops
+	u32 *visited = (u32 *)calloc(stations, sizeof(u32));
+	u8 *covered = (u8 *)calloc(stations, sizeof(u8));
+	u32 covered_count = 0;
+	u32 next_start = 0;
+	u32 line = 0;
+	u32 attempts = 0;
+	u32 max_attempts = (lines > 0) ? lines * 4 : 8 * generate_isqrt_ceil(stations);
+	while ((lines > 0) ? line < lines : covered_count < stations - stations / 10) {
+		if (attempts++ == max_attempts) {
+			break;
+		}
+		while (next_start < stations && covered[order[next_start]]) {
+			next_start++;
+		}
+		u32 current = (next_start < stations) ? order[next_start] : (u32)(rng_next(&gen->rng) % stations);
+		u32 first = current;
+		u32 hops = 0;
+		GeneratePoint goal = { (f32)(rng_next(&gen->rng) % (cells * 64)) / 64.0f, (f32)(rng_next(&gen->rng) % (cells * 64)) / 64.0f };
+		visited[current] = line + 1;
+
+		while (true) {
+			GeneratePoint p = points[current];
+			f32 left = generate_distance(goal.x - p.x, goal.y - p.y);
+			if (left < 1.0f) {
+				break;
+			}
+			u32 best = NO_NODE;
+			f32 best_score = INFINITY;
+			i32 cx = (i32)p.x;
+			i32 cy = (i32)p.y;
+			for (i32 y = cy - 1; y <= cy + 1; y++) {
+				for (i32 x = cx - 1; x <= cx + 1; x++) {
+					if (x < 0 || y < 0 || x >= (i32)cells || y >= (i32)cells) {
+						continue;
+					}
+					u32 cell = (u32)y * cells + (u32)x;
+					for (u32 k = cell_offsets[cell]; k < cell_offsets[cell + 1]; k++) {
+						u32 next = cell_points[k];
+						GeneratePoint q = points[next];
+						f32 to_goal = generate_distance(goal.x - q.x, goal.y - q.y);
+						// Prefer short hops to uncovered stations that still make progress towards the goal
+						f32 score = to_goal + 0.5f * generate_distance(q.x - p.x, q.y - p.y) - (covered[next] ? 0 : 0.5f);
+						if (visited[next] != line + 1 && to_goal < left && score < best_score) {
+							best = next;
+							best_score = score;
+						}
+					}
+				}
+			}
+			if (best == NO_NODE) {
+				break;
+			}
+			f32 distance = generate_distance(points[best].x - p.x, points[best].y - p.y);
+			f32 time = (f32)(u32)(distance * 4.0f + 0.5f) * 0.5f;
+			generate_hop(gen, line, current, best, (time > 0.5f) ? time : 0.5f);
+			visited[best] = line + 1;
+			covered_count += !covered[best];
+			covered[best] = 1;
+			current = best;
+			hops++;
+		}
+		if (hops > 0) {
+			covered_count += !covered[first];
+			covered[first] = 1;
+			line++;
+		}
+	}
+
+	free(order);
+	free(covered);
+	free(visited);
+	free(fill);
+	free(cell_points);
+	free(cell_of);
+	free(cell_offsets);
+	free(points);
+}
+
+/*
+ * Writes a network of about `stations` stations to path. lines is the
+ * spoke count for radial networks (0 for 8) and the line count for random
+ * ones (0 adds lines until nine in ten stations are served); grids always
+ * run one line per row and per column.
+ */
+bool generate_network(GenerateKind kind, u32 stations, u32 lines, u64 seed, char *path) {
+	Generator gen;
+	memset(&gen, 0, sizeof(gen));
+	gen.kind = kind;
+	gen.rng = seed ? seed : 1;
+	gen.out = fopen(path, "w");
+	if (gen.out == NULL) {
+		printf("could not open %s for writing!\n", path);
+		return false;
+	}
+	setvbuf(gen.out, NULL, _IOFBF, 1 << 20);
+
+	if (kind == GENERATE_GRID) {
+		generate_grid(&gen, stations);
+	} else if (kind == GENERATE_RADIAL) {
+		generate_radial(&gen, stations, lines);
+	} else {
+		generate_random(&gen, stations, lines);
+	}
+	generate_transfers(&gen);
+
+	bool ok = !ferror(gen.out);
+	ok = (fclose(gen.out) == 0) && ok;
+	fprintf(stderr, "wrote %u stations, %llu edges to %s\n", gen.station_count, gen.edge_count, path);
+	free(gen.stops);
+	return ok;
+}
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "common.h"
+#include "hashmap.h"
+#include "dynarr.h"
+#include "arena.h"
+#include "file_helper.h"
+
+#define IDVOID(x) ((void *)((u64)(x) + 1))
+#define VOIDID(x) ((u32)((u64)(x) - 1))
+#define NO_NODE ((u32)-1)
+
+#define MAX_NAME_LEN 256
+#define MAX_KEY_LEN ((MAX_NAME_LEN * 2) + 2)
+
+/*
+ * Platforms (a station on a given line) are interned into dense ids at load
+ * time. Edges live in CSR form: the neighbours of node n are
+ * edge_targets[edge_offsets[n]..edge_offsets[n + 1]], with matching times.
+ * Names are only touched when building the graph or printing a route.
+ */
+typedef struct Graph {
+	u32 node_count;
+	u32 edge_count;
+	u32 station_count;
+	u32 line_count;
+
+	u32 *node_station;
+	u32 *node_line;
+
+	u32 *edge_offsets;
+	u32 *edge_targets;
+	f32 *edge_times;
+
+	// platforms serving each station, same CSR layout as the edges
+	u32 *station_offsets;
+	u32 *station_nodes;
+
+	// NUL terminated names packed into one table, indexed by offset
+	char *strings;
+	u64 strings_size;
+	u32 *station_name_off;
+	u32 *line_name_off;
+
+	HashMap *node_ids;
+	HashMap *station_ids;
+	HashMap *line_ids;
+
+	// bumped whenever edge times change, so derived data can tell it is stale
+	u64 version;
+	// double-buffered edge times for live updates, NULL when not in use
+	struct LiveTimes *live;
+
+	// owns everything above, including the Graph itself
+	Arena *arena;
+	// set when the arrays point into a mapped snapshot instead
+	File *snapshot;
+} Graph;
+
+typedef struct RawEdge {
+	u32 from;
+	u32 to;
+	f32 time;
+} RawEdge;
+
+typedef struct StrView {
+	char *ptr;
+	u64 len;
+} StrView;
+
+// One "station, line, station, line, time" line, pointing into the file
+typedef struct EdgeRecord {
+	StrView station1;
+	StrView line1;
+	StrView station2;
+	StrView line2;
+	f32 time;
+} EdgeRecord;
+
+void node_key(char *buffer, char *station, char *line) {
+	snprintf(buffer, MAX_KEY_LEN, "%s~%s", station, line);
+}
+
+static u64 node_key_view(char *buffer, StrView station, StrView line) {
+	memcpy(buffer, station.ptr, station.len);
+	buffer[station.len] = '~';
+	memcpy(buffer + station.len + 1, line.ptr, line.len);
+	return station.len + line.len + 1;
+}
+
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static StrView trim_view(char *start, char *end) {
+	while (start < end && is_blank(*start)) {
+		start++;
+	}
+	while (end > start && is_blank(end[-1])) {
+		end--;
+	}
+	return (StrView){ start, (u64)(end - start) };
+}
+
+// Plain decimal times only; the view isn't NUL terminated, so no strtof
+f32 parse_time(StrView v, bool *ok) {
+	f64 value = 0;
+	f64 scale = 1;
+	bool seen_digit = false;
+	bool seen_point = false;
+
+	for (u64 i = 0; i < v.len; i++) {
+		char c = v.ptr[i];
+		if (c >= '0' && c <= '9') {
+			seen_digit = true;
+			if (seen_point) {
+				scale /= 10;
+				value += (c - '0') * scale;
+			} else {
+				value = (value * 10) + (c - '0');
+			}
+		} else if (c == '.' && !seen_point) {
+			seen_point = true;
+		} else {
+			*ok = false;
+			return 0;
+		}
+	}
+
+	*ok = seen_digit;
+	return (f32)value;
+}
+
+bool parse_edge_record(char *line, char *line_end, EdgeRecord *rec) {
+	StrView fields[5];
+	u32 field_count = 0;
+
+	char *field_start = line;
+	for (char *c = line; c < line_end && field_count < 4; c++) {
+		if (*c == ',') {
+			fields[field_count++] = trim_view(field_start, c);
+			field_start = c + 1;
+		}
+	}
+	if (field_count != 4) {
+		return false;
+	}
+	fields[4] = trim_view(field_start, line_end);
+
+	for (u32 i = 0; i < 4; i++) {
+		if (fields[i].len == 0 || fields[i].len > MAX_NAME_LEN) {
+			return false;
+		}
+	}
+
+	bool ok;
+	rec->time = parse_time(fields[4], &ok);
+	rec->station1 = fields[0];
+	rec->line1 = fields[1];
+	rec->station2 = fields[2];
+	rec->line2 = fields[3];
+	return ok;
+}
+
+typedef struct NameTable {
+	char *strings;
+	u64 size;
+	u64 capacity;
+	Arena *arena;
+} NameTable;
+
+typedef struct NameList {
+	u32 *offsets;
+	u32 count;
+	u32 capacity;
+} NameList;
+
+static u32 name_table_append(NameTable *table, StrView name) {
+	if (table->size + name.len + 1 > table->capacity) {
+		u64 old_capacity = table->capacity;
+		while (table->size + name.len + 1 > table->capacity) {
+			table->capacity *= 2;
+		}
+		table->strings = (char *)mem_realloc(table->arena, table->strings, old_capacity, table->capacity);
+	}
+
+	u32 off = table->size;
+	memcpy(table->strings + off, name.ptr, name.len);
+	table->strings[off + name.len] = 0;
+	table->size += name.len + 1;
+	return off;
+}
+
+static u32 intern_name(HashMap **ids, NameTable *table, NameList *names, StrView name) {
+	void *id = hm_getn(*ids, name.ptr, name.len);
+	if (id) {
+		return VOIDID(id);
+	}
+
+	if (names->count == names->capacity) {
+		names->offsets = (u32 *)mem_realloc(table->arena, names->offsets, sizeof(u32) * names->capacity, sizeof(u32) * names->capacity * 2);
+		names->capacity *= 2;
+	}
+
+	u32 new_id = names->count++;
+	names->offsets[new_id] = name_table_append(table, name);
+	hm_insertn(ids, name.ptr, name.len, IDVOID(new_id));
+	return new_id;
+}
+
+/*
+ * Builds the graph in a single pass over the (usually mmapped) file: each
+ * line is split into views, names are interned straight from the mapping,
+ * and edges are collected then counting sorted into CSR.
+ */
+Graph *graph_build(File *file) {
+	Arena *arena = arena_init();
+	Arena *tmp = arena_init();
+
+	Graph *g = (Graph *)mem_calloc(arena, 1, sizeof(Graph));
+	g->arena = arena;
+	g->node_ids = hm_arena_init(arena);
+	g->station_ids = hm_arena_init(arena);
+	g->line_ids = hm_arena_init(arena);
+
+	NameTable table = { (char *)mem_alloc(tmp, 1024), 0, 1024, tmp };
+	NameList station_names = { (u32 *)mem_alloc(tmp, sizeof(u32) * 16), 0, 16 };
+	NameList line_names = { (u32 *)mem_alloc(tmp, sizeof(u32) * 16), 0, 16 };
+
+	u64 node_count = 0;
+	u64 node_capacity = 16;
+	u32 *node_station = (u32 *)mem_alloc(tmp, sizeof(u32) * node_capacity);
+	u32 *node_line = (u32 *)mem_alloc(tmp, sizeof(u32) * node_capacity);
+
+	u64 raw_edge_count = 0;
+	u64 raw_edge_capacity = 64;
+	RawEdge *raw_edges = (RawEdge *)mem_alloc(tmp, sizeof(RawEdge) * raw_edge_capacity);
+
+	char *cursor = file->string;
+	char *file_end = file->string + file->size;
+	while (cursor < file_end) {
+		char *line_end = (char *)memchr(cursor, '\n', file_end - cursor);
+		if (line_end == NULL) {
+			line_end = file_end;
+		}
+
+		EdgeRecord rec;
+		bool valid = parse_edge_record(cursor, line_end, &rec);
+		cursor = line_end + 1;
+		if (!valid) {
+			continue;
+		}
+
+		StrView stations[2] = { rec.station1, rec.station2 };
+		StrView lines[2] = { rec.line1, rec.line2 };
+		u32 ids[2];
+		for (u32 j = 0; j < 2; j++) {
+			char key[MAX_KEY_LEN];
+			u64 key_len = node_key_view(key, stations[j], lines[j]);
+
+			void *id = hm_getn(g->node_ids, key, key_len);
+			if (id) {
+				ids[j] = VOIDID(id);
+				continue;
+			}
+
+			if (node_count == node_capacity) {
+				node_station = (u32 *)mem_realloc(tmp, node_station, sizeof(u32) * node_capacity, sizeof(u32) * node_capacity * 2);
+				node_line = (u32 *)mem_realloc(tmp, node_line, sizeof(u32) * node_capacity, sizeof(u32) * node_capacity * 2);
+				node_capacity *= 2;
+			}
+
+			ids[j] = node_count++;
+			hm_insertn(&g->node_ids, key, key_len, IDVOID(ids[j]));
+			node_station[ids[j]] = intern_name(&g->station_ids, &table, &station_names, stations[j]);
+			node_line[ids[j]] = intern_name(&g->line_ids, &table, &line_names, lines[j]);
+		}
+
+		if (raw_edge_count + 2 > raw_edge_capacity) {
+			raw_edges = (RawEdge *)mem_realloc(tmp, raw_edges, sizeof(RawEdge) * raw_edge_capacity, sizeof(RawEdge) * raw_edge_capacity * 2);
+			raw_edge_capacity *= 2;
+		}
+
+		// Every connection is walkable in both directions
+		raw_edges[raw_edge_count++] = (RawEdge){ ids[0], ids[1], rec.time };
+		raw_edges[raw_edge_count++] = (RawEdge){ ids[1], ids[0], rec.time };
+	}
+
+	g->node_count = node_count;
+	g->edge_count = raw_edge_count;
+	g->station_count = station_names.count;
+	g->line_count = line_names.count;
+	g->node_station = (u32 *)mem_alloc(arena, sizeof(u32) * (g->node_count + 1));
+	g->node_line = (u32 *)mem_alloc(arena, sizeof(u32) * (g->node_count + 1));
+	memcpy(g->node_station, node_station, sizeof(u32) * g->node_count);
+	memcpy(g->node_line, node_line, sizeof(u32) * g->node_count);
+
+	// Counting sort the edge list into CSR, keeping file order within a node
+	g->edge_offsets = (u32 *)mem_calloc(arena, g->node_count + 1, sizeof(u32));
+	g->edge_targets = (u32 *)mem_alloc(arena, sizeof(u32) * (g->edge_count + 1));
+	g->edge_times = (f32 *)mem_alloc(arena, sizeof(f32) * (g->edge_count + 1));
+	for (u64 i = 0; i < raw_edge_count; i++) {
+		g->edge_offsets[raw_edges[i].from + 1]++;
+	}
+	for (u32 i = 0; i < g->node_count; i++) {
+		g->edge_offsets[i + 1] += g->edge_offsets[i];
+	}
+
+	u32 *fill = (u32 *)mem_alloc(tmp, sizeof(u32) * (g->node_count + g->station_count + 1));
+	memcpy(fill, g->edge_offsets, sizeof(u32) * (g->node_count + 1));
+	for (u64 i = 0; i < raw_edge_count; i++) {
+		u32 slot = fill[raw_edges[i].from]++;
+		g->edge_targets[slot] = raw_edges[i].to;
+		g->edge_times[slot] = raw_edges[i].time;
+	}
+
+	g->station_offsets = (u32 *)mem_calloc(arena, g->station_count + 1, sizeof(u32));
+	g->station_nodes = (u32 *)mem_alloc(arena, sizeof(u32) * (g->node_count + 1));
+	for (u32 i = 0; i < g->node_count; i++) {
+		g->station_offsets[g->node_station[i] + 1]++;
+	}
+	for (u32 i = 0; i < g->station_count; i++) {
+		g->station_offsets[i + 1] += g->station_offsets[i];
+	}
+	memcpy(fill, g->station_offsets, sizeof(u32) * (g->station_count + 1));
+	for (u32 i = 0; i < g->node_count; i++) {
+		g->station_nodes[fill[g->node_station[i]]++] = i;
+	}
+
+	g->strings_size = table.size;
+	g->strings = (char *)mem_alloc(arena, table.size + 1);
+	memcpy(g->strings, table.strings, table.size);
+	g->station_name_off = (u32 *)mem_alloc(arena, sizeof(u32) * (g->station_count + 1));
+	memcpy(g->station_name_off, station_names.offsets, sizeof(u32) * g->station_count);
+	g->line_name_off = (u32 *)mem_alloc(arena, sizeof(u32) * (g->line_count + 1));
+	memcpy(g->line_name_off, line_names.offsets, sizeof(u32) * g->line_count);
+
+	arena_free(tmp);
+
+	return g;
+}
+
+u32 graph_find_node(Graph *g, char *station, char *line) {
+	char key[MAX_KEY_LEN];
+	node_key(key, station, line);
+
+	void *id = hm_get(g->node_ids, key);
+	if (!id) {
+		return NO_NODE;
+	}
+	return VOIDID(id);
+}
+
+u32 graph_find_station(Graph *g, char *station) {
+	void *id = hm_get(g->station_ids, station);
+	if (!id) {
+		return NO_NODE;
+	}
+	return VOIDID(id);
+}
+
+char *station_name(Graph *g, u32 station) {
+	return g->strings + g->station_name_off[station];
+}
+
+char *line_name(Graph *g, u32 line) {
+	return g->strings + g->line_name_off[line];
+}
+
+char *node_name(Graph *g, u32 node) {
+	return station_name(g, g->node_station[node]);
+}
+
+char *node_line_name(Graph *g, u32 node) {
+	return line_name(g, g->node_line[node]);
+}
+
+void print_graph(Graph *g) {
+	for (u32 i = 0; i < g->node_count; i++) {
+		printf("Station %s | %s\n---------\n", node_name(g, i), node_line_name(g, i));
+		for (u32 e = g->edge_offsets[i]; e < g->edge_offsets[i + 1]; e++) {
+			u32 next = g->edge_targets[e];
+			printf("%s %s in %.2gs\n", node_line_name(g, next), node_name(g, next), g->edge_times[e]);
+		}
+		puts("");
+	}
+}
+
+void graph_free(Graph *g) {
+	if (g->snapshot) {
+		close_file(g->snapshot);
+	}
+	arena_free(g->arena);
+}
+
+#endif
@@ -2,202 +2,420 @@
 #define HASHMAP_H
 
 #include "common.h"
+#include "arena.h"
+#include "stats.h"
+
+/*
+ * Open addressing with Robin Hood probing. Each slot keeps a 32 bit hash, so
+ * probe distances and regrowth never rehash a key, and key bytes are only
+ * compared once the hashes match. Short keys live inline in the slot; longer
+ * ones are copied into one owned string arena instead of being strdup'd per
+ * entry. Removal backward-shifts the following run, so there are no
+ * tombstones.
+ *
+ * Growing normally moves every entry at once. With hm_set_incremental the
+ * old table is kept instead and each insert or remove moves the next
+ * HM_MIGRATE_STEP of its slots, so no single call pays for the whole table.
+ * Until it is drained, lookups try the new table and then the old one.
+ * Moved or removed entries stay in the old table as markers that keep their
+ * hash, so its probe runs stay intact without shifting anything, and it is
+ * freed once the last slot is moved. Lookups never migrate, so concurrent
+ * readers stay safe as long as writers are excluded.
+ */
+
+#define HM_EMPTY 0
+#define HM_MIN_CAPACITY 8
+#define HM_INLINE_KEY 16
+// grow once more than this percentage of slots is taken
+#define HM_MAX_LOAD 75
+#define HM_MIGRATE_STEP 32
+// key_len of an old table slot whose entry has moved or been removed
+#define HM_MOVED 0xffffffffu
+
+// Must never return HM_EMPTY
+typedef u32 (*HMHashFn)(char *key, u64 len);
 
 typedef struct HMNode {
-	struct HMNode *next;
-	char *key;
+	u32 hash;
+	u32 key_len;
 	void *data;
+	union {
+		char key[HM_INLINE_KEY];
+		u64 key_off;
+	};
 } HMNode;
 
 typedef struct HMIter {
-	struct HMNode *cur;
 	u64 idx;
 } HMIter;
 
 typedef struct HashMap {
-	HMNode **map;
-	u64 *idx_map;
-	u64 idx_map_size;
+	HMNode *map;
+	char *keys;
+	u64 keys_size;
+	u64 keys_capacity;
+	u64 keys_garbage;
 	u64 size;
 	u64 capacity;
+	u64 mask;
+	// NULL means hm_hash and 0 means HM_MAX_LOAD, which is also what a
+	// map loaded from a snapshot gets
+	HMHashFn hash;
+	u32 max_load;
+	bool incremental;
+	// table being drained by an incremental grow, NULL otherwise; its
+	// slots before old_next have all been moved
+	HMNode *old_map;
+	u64 old_capacity;
+	u64 old_next;
+	Arena *arena;
 } HashMap;
 
-HashMap *hm_sized_init(u64 capacity) {
-	HashMap *hm = (HashMap *)calloc(1, sizeof(HashMap));
+HashMap *hm_arena_sized_init(Arena *arena, u64 capacity) {
+	u64 real_capacity = HM_MIN_CAPACITY;
+	while (real_capacity < capacity) {
+		real_capacity <<= 1;
+	}
+
+	HashMap *hm = (HashMap *)mem_calloc(arena, 1, sizeof(HashMap));
+	hm->arena = arena;
 	hm->size = 0;
-	hm->idx_map_size = 0;
-	hm->capacity = capacity;
-	hm->map = (HMNode **)calloc(hm->capacity, sizeof(HMNode *));
-	hm->idx_map = (u64 *)calloc(hm->capacity, sizeof(u64));
+	hm->capacity = real_capacity;
+	hm->mask = real_capacity - 1;
+	hm->map = (HMNode *)mem_calloc(arena, hm->capacity, sizeof(HMNode));
+	hm->keys_capacity = 64;
+	hm->keys = (char *)mem_alloc(arena, hm->keys_capacity);
 
 	return hm;
 }
 
+HashMap *hm_sized_init(u64 capacity) {
+	return hm_arena_sized_init(NULL, capacity);
+}
+
+HashMap *hm_arena_init(Arena *arena) {
+	return hm_arena_sized_init(arena, 1);
+}
+
 HashMap *hm_init() {
 	HashMap *hm = hm_sized_init(1);
 	return hm;
 }
 
-void print_idx_map(HashMap *hm) {
-	printf("[PRINT_IDX_MAP] idx_map size: %llu, map size: %llu\n", hm->idx_map_size, hm->size);
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		printf("[PRINT_IDX_MAP] %llu\n", hm->idx_map[i]);
-	}
+static inline u64 hm_read64(const char *p) {
+	u64 v;
+	memcpy(&v, p, sizeof(v));
+	return v;
 }
 
-void print_hm(HashMap *hm) {
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-		printf("[PRINT_MAP] key: %s\n", bucket->key);
-		u64 sub_key = 0;
-		while (bucket->next != NULL) {
-			printf("[PRINT_MAP] key: %s\n", bucket->next->key);
-			bucket = bucket->next;
-			sub_key += 1;
-		}
-
-		printf("[PRINT_MAP] sub_key count: %llu\n", sub_key);
-	}
+static inline u64 hm_mix(u64 a, u64 b) {
+	__uint128_t r = (__uint128_t)a * b;
+	return (u64)r ^ (u64)(r >> 64);
 }
 
-char *hm_iter_key(HashMap *hm, HMIter *iter) {
-	if (iter->idx >= hm->idx_map_size) {
-		return NULL;
-	}
+// wyhash-style: fold 8 bytes at a time through a 64x64->128 multiply
+u32 hm_hash(char *key, u64 len) {
+	const u64 p0 = 0xa0761d6478bd642full;
+	const u64 p1 = 0xe7037ed1a0b428dbull;
+	u64 seed = len ^ p0;
 
-	if (!iter->cur) {
-		iter->cur = hm->map[hm->idx_map[iter->idx]];
-		return iter->cur->key;
+	u64 i = 0;
+	for (; i + 8 <= len; i += 8) {
+		seed = hm_mix(hm_read64(key + i) ^ p1, seed ^ p0);
 	}
 
-	if (iter->cur->next) {
-		iter->cur = iter->cur->next;
-		return iter->cur->key;
-	}
+	u64 tail = 0;
+	memcpy(&tail, key + i, len - i);
+	u64 hash = hm_mix(tail ^ p1, seed ^ len);
+
+	// 0 marks an empty slot
+	return ((u32)(hash ^ (hash >> 32))) | 1;
+}
 
-	iter->idx++;
-	if (iter->idx == hm->idx_map_size) {
-		return NULL;
+static inline u32 hm_hash_key(HashMap *hm, char *key, u64 len) {
+	return (hm->hash == NULL) ? hm_hash(key, len) : hm->hash(key, len);
+}
+
+// Only while the map is empty, since stored hashes are never recomputed
+bool hm_set_hash(HashMap *hm, HMHashFn hash) {
+	if (hm->size > 0) {
+		return false;
 	}
+	hm->hash = hash;
+	return true;
+}
 
-	iter->cur = hm->map[hm->idx_map[iter->idx]];
-	return iter->cur->key;
+// Clamped to 10-95%, so an insert always finds an empty slot
+void hm_set_max_load(HashMap *hm, u32 percent) {
+	hm->max_load = (percent < 10) ? 10 : (percent > 95) ? 95 : percent;
 }
 
+void hm_set_incremental(HashMap *hm, bool incremental) {
+	hm->incremental = incremental;
+}
 
-u64 hm_hash(HashMap *hm, char *key) {
-	u64 hash = 0;
-	u64 key_len = strlen(key);
-	for (u32 i = 0; i < key_len; i++) {
-		hash = (hash << 4) ^ (hash >> 28) ^ (u64)key[i];
-	}
-	hash = hash % hm->capacity;
+static inline bool hm_over_load(HashMap *hm) {
+	u64 load = hm->max_load ? hm->max_load : HM_MAX_LOAD;
+	return hm->size * 100 > hm->capacity * load;
+}
 
-	return hash;
+static inline u64 hm_probe_dist_mask(u64 mask, u32 hash, u64 slot) {
+	return (slot - (hash & mask)) & mask;
 }
 
-HMNode *new_hmnode(char *key, void *value) {
-	HMNode *tmp = (HMNode *)malloc(sizeof(HMNode));
-	tmp->data = value;
-	tmp->key = strdup(key);
-	tmp->next = NULL;
-	return tmp;
+static inline u64 hm_probe_dist(HashMap *hm, u32 hash, u64 slot) {
+	return hm_probe_dist_mask(hm->mask, hash, slot);
 }
 
-HashMap *hm_grow_capacity(HashMap *hm, u64 capacity);
+static inline bool hm_key_inline(u64 len) {
+	return len < HM_INLINE_KEY;
+}
 
-void hm_insert(HashMap **hm, char *key, void *value) {
-    if ((*hm)->size > (((*hm)->capacity >> 2) + ((*hm)->capacity >> 1))) {
-		*hm = hm_grow_capacity(*hm, (*hm)->capacity * 2);
+static inline char *hm_node_key(HashMap *hm, HMNode *node) {
+	if (hm_key_inline(node->key_len)) {
+		return node->key;
 	}
+	return hm->keys + node->key_off;
+}
 
-	u64 idx = hm_hash(*hm, key);
-	if (!((*hm)->map[idx])) {
-		(*hm)->map[idx] = new_hmnode(key, value);
-		(*hm)->idx_map[(*hm)->idx_map_size] = idx;
-		(*hm)->idx_map_size++;
-		(*hm)->size++;
-		return;
+static u64 hm_store_key(HashMap *hm, char *key, u64 len) {
+	if (hm->keys_size + len + 1 > hm->keys_capacity) {
+		u64 old_capacity = hm->keys_capacity;
+		while (hm->keys_size + len + 1 > hm->keys_capacity) {
+			hm->keys_capacity *= 2;
+		}
+		hm->keys = (char *)mem_realloc(hm->arena, hm->keys, old_capacity, hm->keys_capacity);
 	}
 
-	HMNode *tmp = (*hm)->map[idx];
-	if (!strcmp(tmp->key, key)) {
-		return;
+	u64 off = hm->keys_size;
+	memcpy(hm->keys + off, key, len);
+	hm->keys[off + len] = 0;
+	hm->keys_size += len + 1;
+	return off;
+}
+
+void hm_finish_grow(HashMap *hm);
+
+void print_hm(HashMap *hm) {
+	hm_finish_grow(hm);
+	u64 max_dist = 0;
+	for (u64 i = 0; i < hm->capacity; i++) {
+		HMNode *node = &hm->map[i];
+		if (node->hash == HM_EMPTY) {
+			continue;
+		}
+
+		u64 dist = hm_probe_dist(hm, node->hash, i);
+		printf("[PRINT_MAP] key: %s, probe distance: %llu\n", hm_node_key(hm, node), dist);
+		if (dist > max_dist) {
+			max_dist = dist;
+		}
 	}
 
-	while (tmp->next) {
-		tmp = tmp->next;
-		if (!strcmp(tmp->key, key)) {
-			return;
+	printf("[PRINT_MAP] size: %llu, capacity: %llu, max probe distance: %llu\n", hm->size, hm->capacity, max_dist);
+}
+
+// Walks the new table, then whatever an incremental grow has not moved yet
+char *hm_iter_key(HashMap *hm, HMIter *iter) {
+	while (iter->idx < hm->capacity) {
+		HMNode *node = &hm->map[iter->idx];
+		iter->idx++;
+		if (node->hash != HM_EMPTY) {
+			return hm_node_key(hm, node);
 		}
 	}
+	while (hm->old_map != NULL && iter->idx < hm->capacity + hm->old_capacity) {
+		HMNode *node = &hm->old_map[iter->idx - hm->capacity];
+		iter->idx++;
+		if (node->hash != HM_EMPTY && node->key_len != HM_MOVED) {
+			return hm_node_key(hm, node);
+		}
+	}
+
+	return NULL;
+}
 
+// Places an entry whose key is already stored, swapping with richer slots
+static void hm_place(HashMap *hm, HMNode entry) {
+	u64 slot = entry.hash & hm->mask;
+	u64 dist = 0;
+	while (true) {
+		HMNode *node = &hm->map[slot];
+		if (node->hash == HM_EMPTY) {
+			*node = entry;
+			return;
+		}
 
-	tmp->next = new_hmnode(key, value);
-	(*hm)->size++;
+		u64 node_dist = hm_probe_dist(hm, node->hash, slot);
+		if (node_dist < dist) {
+			HMNode tmp = *node;
+			*node = entry;
+			entry = tmp;
+			dist = node_dist;
+		}
+
+		slot = (slot + 1) & hm->mask;
+		dist++;
+	}
 }
 
-void hn_free(HMNode *bucket) {
-	free(bucket->key);
-	free(bucket);
+HashMap *hm_grow_capacity(HashMap *hm, u64 capacity);
+
+// Moved markers never match, since no key is HM_MOVED bytes long
+static HMNode *_hm_get_in(HashMap *hm, HMNode *map, u64 mask, u32 hash, char *key, u64 len) {
+	u64 slot = hash & mask;
+	u64 dist = 0;
+	while (true) {
+		HMNode *node = &map[slot];
+		STAT_ADD(hash_probes, 1);
+		STAT_MAX(hash_max_probe, dist + 1);
+		if (node->hash == HM_EMPTY || hm_probe_dist_mask(mask, node->hash, slot) < dist) {
+			return NULL;
+		}
+
+		if (node->hash == hash && node->key_len == len && !memcmp(hm_node_key(hm, node), key, len)) {
+			return node;
+		}
+
+		slot = (slot + 1) & mask;
+		dist++;
+	}
 }
 
-void hn_free_data(HMNode *bucket) {
-	free(bucket->data);
-	hn_free(bucket);
+static HMNode *_hm_get(HashMap *hm, u32 hash, char *key, u64 len) {
+	STAT_ADD(hash_lookups, 1);
+	HMNode *node = _hm_get_in(hm, hm->map, hm->mask, hash, key, len);
+	if (node == NULL && hm->old_map != NULL) {
+		node = _hm_get_in(hm, hm->old_map, hm->old_capacity - 1, hash, key, len);
+	}
+	return node;
 }
 
-HashMap *hm_grow_capacity(HashMap *hm, u64 capacity) {
-	debug("[HM] growing capacity from %llu to %llu because size is %llu\n", hm->capacity, hm->capacity * 2, hm->size);
-	HashMap *new_hm = hm_sized_init(capacity);
+static inline bool hm_in_old(HashMap *hm, HMNode *node) {
+	return hm->old_map != NULL && node >= hm->old_map && node < hm->old_map + hm->old_capacity;
+}
 
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
+static void hm_compact_keys(HashMap *hm);
 
-		HMNode *tmp = bucket;
-		while (tmp->next) {
-			hm_insert(&new_hm, tmp->key, tmp->data);
+// Removed key bytes worth reclaiming: over half the arena and past 4 KiB
+static inline bool hm_should_compact(HashMap *hm) {
+	return hm->keys_garbage > (hm->keys_size >> 1) && hm->keys_garbage > 4096;
+}
 
-			HMNode *prev = tmp;
-			tmp = tmp->next;
-			hn_free(prev);
+// Moves up to count slots out of the old table, freeing it once drained
+static void hm_migrate(HashMap *hm, u64 count) {
+	u64 end = hm->old_next + count;
+	if (end > hm->old_capacity) {
+		end = hm->old_capacity;
+	}
+	for (; hm->old_next < end; hm->old_next++) {
+		HMNode *node = &hm->old_map[hm->old_next];
+		if (node->hash != HM_EMPTY && node->key_len != HM_MOVED) {
+			hm_place(hm, *node);
+			node->key_len = HM_MOVED;
 		}
-		hm_insert(&new_hm, tmp->key, tmp->data);
-		hn_free(tmp);
+	}
+	if (hm->old_next < hm->old_capacity) {
+		return;
 	}
 
-	free(hm->map);
-	free(hm->idx_map);
-	free(hm);
-	return new_hm;
+	mem_free(hm->arena, hm->old_map);
+	hm->old_map = NULL;
+	hm->old_capacity = 0;
+	hm->old_next = 0;
+	if (hm_should_compact(hm)) {
+		hm_compact_keys(hm);
+	}
+}
+
+void hm_finish_grow(HashMap *hm) {
+	if (hm->old_map != NULL) {
+		hm_migrate(hm, hm->old_capacity);
+	}
 }
 
-static HMNode *_hm_get(HashMap *hm, u64 idx, char *key) {
+// Keys don't need to be NUL terminated, so callers can insert string views
+void hm_insertn(HashMap **hm, char *key, u64 len, void *value) {
+	if ((*hm)->old_map != NULL) {
+		hm_migrate(*hm, HM_MIGRATE_STEP);
+	}
+	if (hm_over_load(*hm)) {
+		*hm = hm_grow_capacity(*hm, (*hm)->capacity * 2);
+	}
+
+	u32 hash = hm_hash_key(*hm, key, len);
+	if (_hm_get(*hm, hash, key, len)) {
+		return;
+	}
 
-	HMNode *bucket = hm->map[idx];
-	if (!bucket) {
-		debug("1 key %s, hm->map[%llu] is NULL?\n", key, idx);
-		return NULL;
+	STAT_ADD(hash_inserts, 1);
+	HMNode entry;
+	entry.hash = hash;
+	entry.data = value;
+	entry.key_len = len;
+	if (hm_key_inline(len)) {
+		memcpy(entry.key, key, len);
+		entry.key[len] = 0;
+	} else {
+		entry.key_off = hm_store_key(*hm, key, len);
 	}
+	hm_place(*hm, entry);
+	(*hm)->size++;
+}
+
+void hm_insert(HashMap **hm, char *key, void *value) {
+	hm_insertn(hm, key, strlen(key), value);
+}
 
-	if (!strcmp(bucket->key, key)) {
-		return bucket;
+// Rebuilds the key arena without the bytes of removed keys; never mid-grow
+static void hm_compact_keys(HashMap *hm) {
+	u64 live_size = hm->keys_size - hm->keys_garbage;
+	u64 new_capacity = 64;
+	while (new_capacity < live_size + 1) {
+		new_capacity <<= 1;
 	}
 
-	HMNode *tmp = bucket;
-	while (tmp->next) {
-		tmp = tmp->next;
-		if (!strcmp(tmp->key, key)) {
-			return tmp;
+	char *new_keys = (char *)mem_alloc(hm->arena, new_capacity);
+	u64 off = 0;
+	for (u64 i = 0; i < hm->capacity; i++) {
+		HMNode *node = &hm->map[i];
+		if (node->hash == HM_EMPTY || hm_key_inline(node->key_len)) {
+			continue;
 		}
+		memcpy(new_keys + off, hm->keys + node->key_off, node->key_len + 1);
+		node->key_off = off;
+		off += node->key_len + 1;
 	}
-	debug("2 key %s, hm->map[%llu] is NULL?\n", key, idx);
-	return NULL;
+
+	mem_free(hm->arena, hm->keys);
+	hm->keys = new_keys;
+	hm->keys_size = off;
+	hm->keys_capacity = new_capacity;
+	hm->keys_garbage = 0;
 }
 
-void *hm_get(HashMap *hm, char *key) {
-	u64 idx = hm_hash(hm, key);
-	HMNode *ret = _hm_get(hm, idx, key);
+HashMap *hm_grow_capacity(HashMap *hm, u64 capacity) {
+	debug("[HM] growing capacity from %llu to %llu because size is %llu\n", hm->capacity, capacity, hm->size);
+	// Only one old table at a time; a migration still running finishes here
+	hm_finish_grow(hm);
+	hm->old_map = hm->map;
+	hm->old_capacity = hm->capacity;
+	hm->old_next = 0;
+
+	hm->capacity = capacity;
+	hm->mask = capacity - 1;
+	hm->map = (HMNode *)mem_calloc(hm->arena, capacity, sizeof(HMNode));
+
+	// Stored hashes mean no key is rehashed or copied
+	if (!hm->incremental) {
+		hm_finish_grow(hm);
+	}
+
+	return hm;
+}
+
+void *hm_getn(HashMap *hm, char *key, u64 len) {
+	HMNode *ret = _hm_get(hm, hm_hash_key(hm, key, len), key, len);
 	if (ret) {
 		return ret->data;
 	}
@@ -205,65 +423,70 @@ void *hm_get(HashMap *hm, char *key) {
 	return NULL;
 }
 
-bool hm_remove(HashMap *hm, char *key) {
-	u64 idx = hm_hash(hm, key);
-	HMNode *node = _hm_get(hm, idx, key);
+void *hm_get(HashMap *hm, char *key) {
+	return hm_getn(hm, key, strlen(key));
+}
+
+bool hm_removen(HashMap *hm, char *key, u64 len) {
+	if (hm->old_map != NULL) {
+		hm_migrate(hm, HM_MIGRATE_STEP);
+	}
+	HMNode *node = _hm_get(hm, hm_hash_key(hm, key, len), key, len);
 	if (!node) {
 		return false;
 	}
 
-	HMNode *tmp = node->next;
-
-	if (!tmp) {
-		u64 size = hm->idx_map_size;
-		u64 *idx_map = hm->idx_map;
-
-		idx_map[idx] = idx_map[size - 1];
-		idx_map[size] = -1;
-		hm->idx_map_size -= 1;
+	if (!hm_key_inline(node->key_len)) {
+		hm->keys_garbage += node->key_len + 1;
+	}
+	if (hm_in_old(hm, node)) {
+		node->key_len = HM_MOVED;
+		hm->size--;
+		return true;
 	}
 
-	hn_free(node);
-	hm->map[idx] = tmp;
+	// Backward shift the rest of the probe run into the hole
+	u64 slot = node - hm->map;
+	u64 next = (slot + 1) & hm->mask;
+	while (hm->map[next].hash != HM_EMPTY && hm_probe_dist(hm, hm->map[next].hash, next) > 0) {
+		hm->map[slot] = hm->map[next];
+		slot = next;
+		next = (next + 1) & hm->mask;
+	}
+	hm->map[slot].hash = HM_EMPTY;
 	hm->size--;
 
+	if (hm->size == 0 && hm->old_map == NULL) {
+		hm->keys_size = 0;
+		hm->keys_garbage = 0;
+	} else if (hm->old_map == NULL && hm_should_compact(hm)) {
+		hm_compact_keys(hm);
+	}
+
 	return true;
 }
 
+bool hm_remove(HashMap *hm, char *key) {
+	return hm_removen(hm, key, strlen(key));
+}
+
 void hm_free(HashMap *hm) {
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-
-		HMNode *tmp = bucket;
-		HMNode *prev = tmp;
-		while (tmp->next) {
-			prev = tmp;
-			tmp = tmp->next;
-			hn_free(prev);
-		}
-		hn_free(tmp);
+	if (hm->old_map != NULL) {
+		mem_free(hm->arena, hm->old_map);
 	}
-	free(hm->map);
-	free(hm->idx_map);
-	free(hm);
+	mem_free(hm->arena, hm->map);
+	mem_free(hm->arena, hm->keys);
+	mem_free(hm->arena, hm);
 }
 
 void hm_free_data(HashMap *hm) {
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-
-		HMNode *tmp = bucket;
-		HMNode *prev = tmp;
-		while (tmp->next) {
-			prev = tmp;
-			tmp = tmp->next;
-			hn_free_data(prev);
+	hm_finish_grow(hm);
+	for (u64 i = 0; i < hm->capacity; i++) {
+		if (hm->map[i].hash != HM_EMPTY) {
+			mem_free(hm->arena, hm->map[i].data);
 		}
-		hn_free_data(tmp);
 	}
-	free(hm->map);
-	free(hm->idx_map);
-	free(hm);
+	hm_free(hm);
 }
 
 #endif
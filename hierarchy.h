@@ -0,0 +1,411 @@
+#ifndef HIERARCHY_H
+#define HIERARCHY_H
+
+#include <math.h>
+
+#include "common.h"
+#include "file_helper.h"
+#include "graph.h"
+#include "router.h"
+#include "snapshot.h"
+
+/*
+ * Contraction hierarchy preprocessing. Platforms are contracted one at a
+ * time, cheapest first by a lazily re-evaluated priority (edge difference
+ * plus contracted neighbours, which spreads contraction evenly). Contracting
+ * v adds a shortcut u-w for every pair of remaining neighbours unless a
+ * bounded witness search finds a path u..w avoiding v that is no longer
+ * than u-v-w. Transfer edges (A YELLOW - A GREEN) are ordinary edges here.
+ * The result is written next to the snapshot and mapped on later runs.
+ */
+
+#define HIERARCHY_MAGIC "TRAMCHIE"
+#define HIERARCHY_VERSION 1
+#define WITNESS_SETTLE_LIMIT 500
+
+enum {
+	CH_UP_OFFSETS,
+	CH_UP_TARGETS,
+	CH_UP_WEIGHTS,
+	CH_UP_SOURCES,
+	CH_UP_CHILDREN,
+	CH_SECTION_COUNT
+};
+
+typedef struct HierarchyHeader {
+	char magic[8];
+	u32 version;
+	u32 section_count;
+	u64 file_size;
+	u64 checksum;
+	// identifies the graph the hierarchy was built from
+	u64 graph_checksum;
+	u32 node_count;
+	u32 edge_count;
+	u32 shortcut_count;
+	u32 padding;
+	SnapshotSection sections[CH_SECTION_COUNT];
+} HierarchyHeader;
+
+// A remaining neighbour during contraction, and the edge that reaches it
+typedef struct ChLink {
+	u32 node;
+	u32 edge;
+} ChLink;
+
+typedef struct ChBuilder {
+	Graph *g;
+	SearchContext *witness;
+
+	ChLink **links;
+	u32 *link_count;
+	u32 *link_capacity;
+	bool *contracted;
+	u32 *contracted_neighbours;
+
+	// every edge ever created, by undirected endpoints a and b
+	u32 *ends;
+	f32 *weights;
+	u32 *children;
+	u32 edge_count;
+	u32 edge_capacity;
+	u32 shortcut_count;
+} ChBuilder;
+
+static void ch_link(ChBuilder *b, u32 from, u32 node, u32 edge) {
+	if (b->link_count[from] == b->link_capacity[from]) {
+		b->link_capacity[from] = b->link_capacity[from] ? b->link_capacity[from] * 2 : 4;
+		b->links[from] = (ChLink *)realloc(b->links[from], sizeof(ChLink) * b->link_capacity[from]);
+	}
+	b->links[from][b->link_count[from]++] = (ChLink){ node, edge };
+}
+
+static void ch_unlink(ChBuilder *b, u32 from, u32 node) {
+	for (u32 i = 0; i < b->link_count[from]; i++) {
+		if (b->links[from][i].node == node) {
+			b->links[from][i] = b->links[from][--b->link_count[from]];
+			return;
+		}
+	}
+}
+
+// Adds edge a-b unless one at least as cheap exists; a cheaper one takes over the link
+static void ch_add_edge(ChBuilder *b, u32 from, u32 to, f32 weight, u32 child_a, u32 child_b) {
+	ChLink *existing = NULL;
+	for (u32 i = 0; i < b->link_count[from]; i++) {
+		if (b->links[from][i].node == to) {
+			existing = &b->links[from][i];
+			break;
+		}
+	}
+	if (existing != NULL && b->weights[existing->edge] <= weight) {
+		return;
+	}
+
+	if (b->edge_count == b->edge_capacity) {
+		b->edge_capacity *= 2;
+		b->ends = (u32 *)realloc(b->ends, sizeof(u32) * 2 * b->edge_capacity);
+		b->weights = (f32 *)realloc(b->weights, sizeof(f32) * b->edge_capacity);
+		b->children = (u32 *)realloc(b->children, sizeof(u32) * 2 * b->edge_capacity);
+	}
+	u32 e = b->edge_count++;
+	b->ends[e * 2] = from;
+	b->ends[(e * 2) + 1] = to;
+	b->weights[e] = weight;
+	b->children[e * 2] = child_a;
+	b->children[(e * 2) + 1] = child_b;
+	if (child_a != NO_NODE) {
+		b->shortcut_count++;
+	}
+
+	if (existing != NULL) {
+		existing->edge = e;
+		for (u32 i = 0; i < b->link_count[to]; i++) {
+			if (b->links[to][i].node == from) {
+				b->links[to][i].edge = e;
+			}
+		}
+	} else {
+		ch_link(b, from, to, e);
+		ch_link(b, to, from, e);
+	}
+}
+
+// Dijkstra over the remaining graph from source, never entering skip
+static void ch_witness(ChBuilder *b, u32 source, u32 skip, f32 max_cost) {
+	SearchContext *ctx = b->witness;
+	search_begin(ctx, b->g);
+	search_set(ctx, source, 0.0f, NO_NODE);
+	ih_push(ctx->frontier, source, 0);
+
+	u32 settled = 0;
+	while (ctx->frontier->size > 0 && settled < WITNESS_SETTLE_LIMIT) {
+		f32 current_cost;
+		u32 current = ih_pop(ctx->frontier, &current_cost);
+		settled++;
+		if (current_cost > max_cost) {
+			break;
+		}
+
+		for (u32 i = 0; i < b->link_count[current]; i++) {
+			ChLink link = b->links[current][i];
+			if (link.node == skip) {
+				continue;
+			}
+			f32 new_cost = current_cost + b->weights[link.edge];
+			if (new_cost < search_cost(ctx, link.node)) {
+				search_set(ctx, link.node, new_cost, current);
+				ih_push(ctx->frontier, link.node, new_cost);
+			}
+		}
+	}
+}
+
+/*
+ * Finds the shortcuts contracting v needs. With apply unset it only counts
+ * them, which is how priorities are estimated.
+ */
+static u32 ch_contract(ChBuilder *b, u32 v, bool apply) {
+	u32 shortcuts = 0;
+	u32 count = b->link_count[v];
+	for (u32 i = 0; i + 1 < count; i++) {
+		ChLink from = b->links[v][i];
+		f32 from_weight = b->weights[from.edge];
+
+		f32 max_weight = 0;
+		for (u32 j = i + 1; j < count; j++) {
+			f32 w = b->weights[b->links[v][j].edge];
+			if (w > max_weight) {
+				max_weight = w;
+			}
+		}
+		ch_witness(b, from.node, v, from_weight + max_weight);
+
+		for (u32 j = i + 1; j < count; j++) {
+			ChLink to = b->links[v][j];
+			f32 via = from_weight + b->weights[to.edge];
+			if (search_cost(b->witness, to.node) <= via) {
+				continue;
+			}
+			shortcuts++;
+			if (apply) {
+				ch_add_edge(b, from.node, to.node, via, from.edge, to.edge);
+			}
+		}
+	}
+	return shortcuts;
+}
+
+static f32 ch_priority(ChBuilder *b, u32 v) {
+	f32 difference = (f32)ch_contract(b, v, false) - (f32)b->link_count[v];
+	return (2 * difference) + b->contracted_neighbours[v];
+}
+
+// Sorts every edge under its lower ranked endpoint, remapping child ids
+static Hierarchy *ch_finish(ChBuilder *b, u32 *rank) {
+	u32 n = b->g->node_count;
+	Hierarchy *ch = (Hierarchy *)calloc(1, sizeof(Hierarchy));
+	ch->version = b->g->version;
+	ch->node_count = n;
+	ch->edge_count = b->edge_count;
+	ch->shortcut_count = b->shortcut_count;
+	ch->up_offsets = (u32 *)calloc(n + 1, sizeof(u32));
+	ch->up_targets = (u32 *)malloc(sizeof(u32) * (b->edge_count + 1));
+	ch->up_weights = (f32 *)malloc(sizeof(f32) * (b->edge_count + 1));
+	ch->up_sources = (u32 *)malloc(sizeof(u32) * (b->edge_count + 1));
+	ch->up_children = (u32 *)malloc(sizeof(u32) * 2 * (b->edge_count + 1));
+
+	u32 *lower = (u32 *)malloc(sizeof(u32) * (b->edge_count + 1));
+	for (u32 e = 0; e < b->edge_count; e++) {
+		u32 a = b->ends[e * 2];
+		u32 c = b->ends[(e * 2) + 1];
+		lower[e] = (rank[a] < rank[c]) ? a : c;
+		ch->up_offsets[lower[e] + 1]++;
+	}
+	for (u32 i = 0; i < n; i++) {
+		ch->up_offsets[i + 1] += ch->up_offsets[i];
+	}
+
+	u32 *fill = (u32 *)malloc(sizeof(u32) * (n + 1));
+	u32 *slot = (u32 *)malloc(sizeof(u32) * (b->edge_count + 1));
+	memcpy(fill, ch->up_offsets, sizeof(u32) * (n + 1));
+	for (u32 e = 0; e < b->edge_count; e++) {
+		slot[e] = fill[lower[e]]++;
+	}
+	for (u32 e = 0; e < b->edge_count; e++) {
+		u32 s = slot[e];
+		u32 a = b->ends[e * 2];
+		ch->up_sources[s] = lower[e];
+		ch->up_targets[s] = (a == lower[e]) ? b->ends[(e * 2) + 1] : a;
+		ch->up_weights[s] = b->weights[e];
+
+		// children[0] touches the source, children[1] the target
+		u32 child_a = b->children[e * 2];
+		u32 child_b = b->children[(e * 2) + 1];
+		if (child_a != NO_NODE && a != lower[e]) {
+			u32 tmp = child_a;
+			child_a = child_b;
+			child_b = tmp;
+		}
+		ch->up_children[s * 2] = (child_a == NO_NODE) ? NO_NODE : slot[child_a];
+		ch->up_children[(s * 2) + 1] = (child_b == NO_NODE) ? NO_NODE : slot[child_b];
+	}
+
+	free(lower);
+	free(fill);
+	free(slot);
+	return ch;
+}
+
+Hierarchy *hierarchy_build(Graph *g) {
+	u32 n = g->node_count;
+	ChBuilder b;
+	memset(&b, 0, sizeof(b));
+	b.g = g;
+	b.witness = search_init(n);
+	b.links = (ChLink **)calloc(n + 1, sizeof(ChLink *));
+	b.link_count = (u32 *)calloc(n + 1, sizeof(u32));
+	b.link_capacity = (u32 *)calloc(n + 1, sizeof(u32));
+	b.contracted = (bool *)calloc(n + 1, sizeof(bool));
+	b.contracted_neighbours = (u32 *)calloc(n + 1, sizeof(u32));
+	b.edge_capacity = (g->edge_count / 2) + 16;
+	b.ends = (u32 *)malloc(sizeof(u32) * 2 * b.edge_capacity);
+	b.weights = (f32 *)malloc(sizeof(f32) * b.edge_capacity);
+	b.children = (u32 *)malloc(sizeof(u32) * 2 * b.edge_capacity);
+
+	// Both directions of a connection fold into one undirected edge
+	for (u32 u = 0; u < n; u++) {
+		for (u32 e = g->edge_offsets[u]; e < g->edge_offsets[u + 1]; e++) {
+			if (g->edge_targets[e] != u) {
+				ch_add_edge(&b, u, g->edge_targets[e], g->edge_times[e], NO_NODE, NO_NODE);
+			}
+		}
+	}
+
+	IndexedHeap *order = ih_init(n, HEAP_ARITY);
+	for (u32 v = 0; v < n; v++) {
+		ih_push(order, v, ch_priority(&b, v));
+	}
+
+	u32 *rank = (u32 *)malloc(sizeof(u32) * (n + 1));
+	u32 next_rank = 0;
+	while (order->size > 0) {
+		u32 v = ih_pop(order, NULL);
+
+		// Lazy update: priorities drift as neighbours go, so re-check before committing
+		f32 priority = ch_priority(&b, v);
+		if (order->size > 0 && priority > order->heap[0].key) {
+			ih_push(order, v, priority);
+			continue;
+		}
+
+		ch_contract(&b, v, true);
+		rank[v] = next_rank++;
+		b.contracted[v] = true;
+		for (u32 i = 0; i < b.link_count[v]; i++) {
+			u32 u = b.links[v][i].node;
+			ch_unlink(&b, u, v);
+			b.contracted_neighbours[u]++;
+		}
+	}
+
+	Hierarchy *ch = ch_finish(&b, rank);
+
+	for (u32 v = 0; v < n; v++) {
+		free(b.links[v]);
+	}
+	free(b.links);
+	free(b.link_count);
+	free(b.link_capacity);
+	free(b.contracted);
+	free(b.contracted_neighbours);
+	free(b.ends);
+	free(b.weights);
+	free(b.children);
+	free(rank);
+	ih_free(order);
+	search_free(b.witness);
+	return ch;
+}
+
+void hierarchy_free(Hierarchy *ch) {
+	if (ch->file != NULL) {
+		close_file(ch->file);
+	} else {
+		free(ch->up_offsets);
+		free(ch->up_targets);
+		free(ch->up_weights);
+		free(ch->up_sources);
+		free(ch->up_children);
+	}
+	free(ch);
+}
+
+bool hierarchy_write(Hierarchy *ch, Graph *g, char *filename) {
+	void *data[CH_SECTION_COUNT] = {
+		ch->up_offsets, ch->up_targets, ch->up_weights, ch->up_sources, ch->up_children
+	};
+	u64 sizes[CH_SECTION_COUNT] = {
+		sizeof(u32) * (ch->node_count + 1),
+		sizeof(u32) * ch->edge_count,
+		sizeof(f32) * ch->edge_count,
+		sizeof(u32) * ch->edge_count,
+		sizeof(u32) * 2 * ch->edge_count,
+	};
+
+	HierarchyHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HIERARCHY_MAGIC, 8);
+	header.version = HIERARCHY_VERSION;
+	header.section_count = CH_SECTION_COUNT;
+	header.graph_checksum = graph_checksum(g);
+	header.node_count = ch->node_count;
+	header.edge_count = ch->edge_count;
+	header.shortcut_count = ch->shortcut_count;
+	header.file_size = sections_layout(sizeof(header), header.sections, data, sizes, CH_SECTION_COUNT, &header.checksum);
+
+	return sections_write(filename, &header, sizeof(header), header.sections, data, CH_SECTION_COUNT, header.file_size);
+}
+
+// Maps a saved hierarchy; NULL if it is missing, corrupt or built from another graph
+Hierarchy *hierarchy_load(Graph *g, char *filename) {
+	File *file = map_file(filename);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	HierarchyHeader *header = (HierarchyHeader *)file->string;
+	char *error = NULL;
+	if (file->size < sizeof(HierarchyHeader) || memcmp(header->magic, HIERARCHY_MAGIC, 8)) {
+		error = "not a hierarchy";
+	} else if (header->version != HIERARCHY_VERSION || header->section_count != CH_SECTION_COUNT) {
+		error = "unsupported hierarchy version";
+	} else if (header->node_count != g->node_count || header->graph_checksum != graph_checksum(g)) {
+		error = "built from a different network";
+	} else {
+		error = sections_check(file, header->file_size, header->sections, CH_SECTION_COUNT, true, header->checksum);
+	}
+
+	if (error) {
+		printf("%s: %s!\n", filename, error);
+		close_file(file);
+		return NULL;
+	}
+
+	u8 *base = (u8 *)file->string;
+	SnapshotSection *sec = header->sections;
+	Hierarchy *ch = (Hierarchy *)calloc(1, sizeof(Hierarchy));
+	ch->file = file;
+	ch->version = g->version;
+	ch->node_count = header->node_count;
+	ch->edge_count = header->edge_count;
+	ch->shortcut_count = header->shortcut_count;
+	ch->up_offsets = (u32 *)(base + sec[CH_UP_OFFSETS].offset);
+	ch->up_targets = (u32 *)(base + sec[CH_UP_TARGETS].offset);
+	ch->up_weights = (f32 *)(base + sec[CH_UP_WEIGHTS].offset);
+	ch->up_sources = (u32 *)(base + sec[CH_UP_SOURCES].offset);
+	ch->up_children = (u32 *)(base + sec[CH_UP_CHILDREN].offset);
+	return ch;
+}
+
+#endif
@@ -0,0 +1,290 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <stdarg.h>
+
+#include "common.h"
+
+/*
+ * Just enough JSON for the line protocol: a growable output buffer with
+ * string escaping, and a parser for one flat object per line. Nested
+ * values are skipped, scalars are kept as raw text and strings are
+ * unescaped (\u escapes outside ASCII are dropped).
+ */
+
+#define JSON_MAX_FIELDS 16
+#define JSON_MAX_KEY 32
+#define JSON_MAX_VALUE 257
+
+typedef struct StrBuf {
+	char *buffer;
+	u64 size;
+	u64 capacity;
+} StrBuf;
+
+StrBuf *sb_init() {
+	StrBuf *sb = (StrBuf *)malloc(sizeof(StrBuf));
+	sb->capacity = 4096;
+	sb->size = 0;
+	sb->buffer = (char *)malloc(sb->capacity);
+	return sb;
+}
+
+void sb_reserve(StrBuf *sb, u64 extra) {
+	if (sb->size + extra + 1 > sb->capacity) {
+		while (sb->size + extra + 1 > sb->capacity) {
+			sb->capacity *= 2;
+		}
+		sb->buffer = (char *)realloc(sb->buffer, sb->capacity);
+	}
+}
+
+void sb_append(StrBuf *sb, char *str, u64 len) {
+	sb_reserve(sb, len);
+	memcpy(sb->buffer + sb->size, str, len);
+	sb->size += len;
+	sb->buffer[sb->size] = 0;
+}
+
+void sb_puts(StrBuf *sb, char *str) {
+	sb_append(sb, str, strlen(str));
+}
+
+void sb_printf(StrBuf *sb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void sb_printf(StrBuf *sb, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(sb->buffer + sb->size, sb->capacity - sb->size, fmt, args);
+	va_end(args);
+
+	if (len >= 0 && sb->size + len + 1 > sb->capacity) {
+		sb_reserve(sb, len);
+		va_start(args, fmt);
+		vsnprintf(sb->buffer + sb->size, sb->capacity - sb->size, fmt, args);
+		va_end(args);
+	}
+	if (len > 0) {
+		sb->size += len;
+	}
+}
+
+void sb_clear(StrBuf *sb) {
+	sb->size = 0;
+}
+
+void sb_free(StrBuf *sb) {
+	free(sb->buffer);
+	free(sb);
+}
+
+void json_write_string(StrBuf *sb, char *str) {
+	sb_reserve(sb, 2);
+	sb->buffer[sb->size++] = '"';
+	for (char *c = str; *c; c++) {
+		switch (*c) {
+			case '"': sb_append(sb, "\\\"", 2); break;
+			case '\\': sb_append(sb, "\\\\", 2); break;
+			case '\n': sb_append(sb, "\\n", 2); break;
+			case '\r': sb_append(sb, "\\r", 2); break;
+			case '\t': sb_append(sb, "\\t", 2); break;
+			default:
+				if ((u8)*c < 0x20) {
+					sb_printf(sb, "\\u%04x", (u8)*c);
+				} else {
+					sb_append(sb, c, 1);
+				}
+		}
+	}
+	sb_append(sb, "\"", 1);
+}
+
+typedef struct JsonField {
+	char key[JSON_MAX_KEY];
+	char value[JSON_MAX_VALUE];
+	bool is_string;
+} JsonField;
+
+typedef struct JsonObject {
+	JsonField fields[JSON_MAX_FIELDS];
+	u32 count;
+} JsonObject;
+
+static char *json_skip_ws(char *c, char *end) {
+	while (c < end && (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')) {
+		c++;
+	}
+	return c;
+}
+
+// Reads a string starting at the opening quote into out (truncating), returns the char after it
+static char *json_read_string(char *c, char *end, char *out, u64 out_size) {
+	u64 len = 0;
+	c++;
+	while (c < end && *c != '"') {
+		char ch = *c++;
+		if (ch == '\\') {
+			if (c >= end) {
+				return NULL;
+			}
+			char esc = *c++;
+			switch (esc) {
+				case 'n': ch = '\n'; break;
+				case 't': ch = '\t'; break;
+				case 'r': ch = '\r'; break;
+				case 'b': ch = '\b'; break;
+				case 'f': ch = '\f'; break;
+				case 'u': {
+					if (end - c < 4) {
+						return NULL;
+					}
+					char hex[5] = { c[0], c[1], c[2], c[3], 0 };
+					long code = strtol(hex, NULL, 16);
+					c += 4;
+					ch = (code > 0 && code < 0x80) ? (char)code : 0;
+					break;
+				}
+				default: ch = esc; break;
+			}
+			if (!ch) {
+				continue;
+			}
+		}
+		if (len + 1 < out_size) {
+			out[len++] = ch;
+		}
+	}
+	if (c >= end) {
+		return NULL;
+	}
+	out[len] = 0;
+	return c + 1;
+}
+
+static char *json_skip_value(char *c, char *end) {
+	u32 depth = 0;
+	while (c < end) {
+		if (*c == '"') {
+			char tmp[1];
+			c = json_read_string(c, end, tmp, 1);
+			if (c == NULL) {
+				return NULL;
+			}
+			if (depth == 0) {
+				return c;
+			}
+			continue;
+		}
+		if (*c == '{' || *c == '[') {
+			depth++;
+		} else if (*c == '}' || *c == ']') {
+			if (depth == 0) {
+				return c;
+			}
+			depth--;
+			if (depth == 0) {
+				return c + 1;
+			}
+		} else if (depth == 0 && (*c == ',' || *c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')) {
+			return c;
+		}
+		c++;
+	}
+	return (depth == 0) ? c : NULL;
+}
+
+bool json_parse_object(char *line, u64 len, JsonObject *obj) {
+	char *end = line + len;
+	char *c = json_skip_ws(line, end);
+	obj->count = 0;
+
+	if (c >= end || *c != '{') {
+		return false;
+	}
+	c = json_skip_ws(c + 1, end);
+	if (c < end && *c == '}') {
+		return true;
+	}
+
+	while (c < end) {
+		if (*c != '"') {
+			return false;
+		}
+
+		JsonField scratch;
+		JsonField *field = (obj->count < JSON_MAX_FIELDS) ? &obj->fields[obj->count] : &scratch;
+		c = json_read_string(c, end, field->key, JSON_MAX_KEY);
+		if (c == NULL) {
+			return false;
+		}
+		c = json_skip_ws(c, end);
+		if (c >= end || *c != ':') {
+			return false;
+		}
+		c = json_skip_ws(c + 1, end);
+		if (c >= end) {
+			return false;
+		}
+
+		if (*c == '"') {
+			field->is_string = true;
+			c = json_read_string(c, end, field->value, JSON_MAX_VALUE);
+		} else {
+			field->is_string = false;
+			char *value_end = json_skip_value(c, end);
+			if (value_end == NULL || value_end == c) {
+				return false;
+			}
+			u64 value_len = value_end - c;
+			if (value_len >= JSON_MAX_VALUE) {
+				value_len = JSON_MAX_VALUE - 1;
+			}
+			memcpy(field->value, c, value_len);
+			field->value[value_len] = 0;
+			c = value_end;
+		}
+		if (c == NULL) {
+			return false;
+		}
+		if (field != &scratch) {
+			obj->count++;
+		}
+
+		c = json_skip_ws(c, end);
+		if (c < end && *c == ',') {
+			c = json_skip_ws(c + 1, end);
+			continue;
+		}
+		return c < end && *c == '}';
+	}
+	return false;
+}
+
+JsonField *json_get(JsonObject *obj, char *key) {
+	for (u32 i = 0; i < obj->count; i++) {
+		if (!strcmp(obj->fields[i].key, key)) {
+			return &obj->fields[i];
+		}
+	}
+	return NULL;
+}
+
+char *json_get_string(JsonObject *obj, char *key) {
+	JsonField *field = json_get(obj, key);
+	if (field == NULL || !field->is_string) {
+		return NULL;
+	}
+	return field->value;
+}
+
+// Reads a bare or quoted number; false if missing or not a number
+bool json_get_number(JsonObject *obj, char *key, f64 *out) {
+	JsonField *field = json_get(obj, key);
+	if (field == NULL) {
+		return false;
+	}
+	char *rest;
+	*out = strtod(field->value, &rest);
+	return rest != field->value && *rest == 0;
+}
+
+#endif
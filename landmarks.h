@@ -0,0 +1,112 @@
+#ifndef LANDMARKS_H
+#define LANDMARKS_H
+
+#include <math.h>
+
+#include "common.h"
+#include "graph.h"
+#include "router.h"
+
+/*
+ * ALT preprocessing: pick landmark platforms and store the exact travel
+ * time from each of them to every platform, one full Dijkstra per landmark.
+ * "random" picks distinct platforms uniformly; "farthest" starts from a
+ * random platform and greedily adds whichever platform is farthest from all
+ * landmarks chosen so far (unreachable counts as farthest, so every
+ * component gets covered), which gives tighter bounds for the same count.
+ */
+
+typedef enum LandmarkStrategy {
+	LANDMARK_RANDOM,
+	LANDMARK_FARTHEST,
+} LandmarkStrategy;
+
+bool parse_landmark_strategy(char *name, LandmarkStrategy *strategy) {
+	if (!strcmp(name, "random")) {
+		*strategy = LANDMARK_RANDOM;
+	} else if (!strcmp(name, "farthest")) {
+		*strategy = LANDMARK_FARTHEST;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+static void landmark_fill(Graph *g, SearchContext *ctx, Landmarks *lm, u32 l) {
+	u32 node = lm->nodes[l];
+	search_dijkstra(g, ctx, &node, 1, NO_NODE);
+	for (u32 v = 0; v < g->node_count; v++) {
+		lm->dist[((u64)v * lm->count) + l] = search_cost(ctx, v);
+	}
+}
+
+Landmarks *landmarks_build(Graph *g, u32 count, LandmarkStrategy strategy, u64 seed) {
+	if (count > g->node_count) {
+		count = g->node_count;
+	}
+
+	Landmarks *lm = (Landmarks *)malloc(sizeof(Landmarks));
+	lm->version = g->version;
+	lm->count = count;
+	lm->node_count = g->node_count;
+	lm->nodes = (u32 *)malloc(sizeof(u32) * (count + 1));
+	lm->dist = (f32 *)malloc(sizeof(f32) * ((u64)g->node_count * count + 1));
+	if (count == 0) {
+		return lm;
+	}
+
+	SearchContext *ctx = search_init(g->node_count);
+	u64 rng = seed ? seed : 0x9E3779B97F4A7C15ull;
+
+	if (strategy == LANDMARK_RANDOM) {
+		for (u32 l = 0; l < count; l++) {
+			u32 node;
+			bool taken;
+			do {
+				node = rng_next(&rng) % g->node_count;
+				taken = false;
+				for (u32 k = 0; k < l; k++) {
+					taken = taken || lm->nodes[k] == node;
+				}
+			} while (taken);
+			lm->nodes[l] = node;
+			landmark_fill(g, ctx, lm, l);
+		}
+	} else {
+		f32 *nearest = (f32 *)malloc(sizeof(f32) * g->node_count);
+		for (u32 v = 0; v < g->node_count; v++) {
+			nearest[v] = INFINITY;
+		}
+
+		u32 node = rng_next(&rng) % g->node_count;
+		for (u32 l = 0; l < count; l++) {
+			lm->nodes[l] = node;
+			landmark_fill(g, ctx, lm, l);
+
+			// next landmark: the platform whose closest landmark is farthest away
+			f32 best = -1;
+			for (u32 v = 0; v < g->node_count; v++) {
+				f32 d = lm->dist[((u64)v * count) + l];
+				if (d < nearest[v]) {
+					nearest[v] = d;
+				}
+				if (nearest[v] > best) {
+					best = nearest[v];
+					node = v;
+				}
+			}
+		}
+		free(nearest);
+	}
+
+	search_free(ctx);
+	return lm;
+}
+
+void landmarks_free(Landmarks *lm) {
+	free(lm->nodes);
+	free(lm->dist);
+	free(lm);
+}
+
+#endif
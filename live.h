@@ -0,0 +1,303 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "common.h"
+#include "graph.h"
+
+/*
+ * Live edge times. Two copies of the edge time array are kept; queries pin
+ * whichever is current for their whole run and never take a lock. A writer
+ * patches the idle copy, publishes it, waits for queries still pinned to the
+ * old copy to finish, then replays the same patch onto the old copy so both
+ * agree again. An update therefore touches only the edges it changes (twice)
+ * and readers always see one consistent set of times. Writers are serialized
+ * by a mutex. The graph's own edge_times stay as loaded and serve as the
+ * base that delays are measured from and reopened edges return to.
+ *
+ *   delay A GREEN B GREEN +3   base time plus 3 minutes, both directions
+ *   close N BLUE M BLUE        no longer walkable
+ *   open N BLUE M BLUE         back to the base time
+ *
+ * Fields may also be separated by commas, as in stations.log, for names
+ * containing spaces.
+ */
+
+#define LIVE_MAX_UPDATES 16
+
+typedef struct LiveTimes {
+	f32 *copies[2];
+	u64 versions[2];
+	u32 current;
+	u64 readers[2];
+	pthread_mutex_t writer;
+	u64 edges_changed;
+} LiveTimes;
+
+typedef enum UpdateKind {
+	UPDATE_DELAY,
+	UPDATE_CLOSE,
+	UPDATE_OPEN,
+} UpdateKind;
+
+typedef struct LiveUpdate {
+	UpdateKind kind;
+	u32 from;
+	u32 to;
+	f32 delta;
+} LiveUpdate;
+
+LiveTimes *live_init(Graph *g) {
+	LiveTimes *live = (LiveTimes *)calloc(1, sizeof(LiveTimes));
+	for (u32 i = 0; i < 2; i++) {
+		live->copies[i] = (f32 *)malloc(sizeof(f32) * (g->edge_count + 1));
+		memcpy(live->copies[i], g->edge_times, sizeof(f32) * g->edge_count);
+		live->versions[i] = g->version;
+	}
+	pthread_mutex_init(&live->writer, NULL);
+	g->live = live;
+	return live;
+}
+
+void live_free(Graph *g) {
+	LiveTimes *live = g->live;
+	free(live->copies[0]);
+	free(live->copies[1]);
+	pthread_mutex_destroy(&live->writer);
+	free(live);
+	g->live = NULL;
+}
+
+/*
+ * Pins the current copy. Re-checking after the increment closes the race
+ * with a writer that flipped in between: either the writer sees our count
+ * and waits, or we see its flip and move to the new copy.
+ */
+static inline u32 live_pin(LiveTimes *live, f32 **times, u64 *version) {
+	while (true) {
+		u32 slot = __atomic_load_n(&live->current, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&live->readers[slot], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&live->current, __ATOMIC_SEQ_CST) == slot) {
+			*times = live->copies[slot];
+			*version = live->versions[slot];
+			return slot;
+		}
+		__atomic_fetch_sub(&live->readers[slot], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static inline void live_unpin(LiveTimes *live, u32 slot) {
+	__atomic_fetch_sub(&live->readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+static u64 live_patch(Graph *g, f32 *times, LiveUpdate *update) {
+	u64 changed = 0;
+	u32 ends[2] = { update->from, update->to };
+	for (u32 side = 0; side < 2; side++) {
+		u32 node = ends[side];
+		u32 other = ends[1 - side];
+		for (u32 e = g->edge_offsets[node]; e < g->edge_offsets[node + 1]; e++) {
+			if (g->edge_targets[e] != other) {
+				continue;
+			}
+			f32 time = g->edge_times[e];
+			if (update->kind == UPDATE_CLOSE) {
+				time = INFINITY;
+			} else if (update->kind == UPDATE_DELAY) {
+				time = (time + update->delta > 0) ? time + update->delta : 0;
+			}
+			times[e] = time;
+			changed++;
+		}
+	}
+	return changed;
+}
+
+// Applies a group of updates as one step; returns the number of directed edges changed
+u64 live_apply(Graph *g, LiveUpdate *updates, u32 count) {
+	LiveTimes *live = g->live;
+	get_lock(&live->writer);
+
+	u32 old = live->current;
+	u32 next = 1 - old;
+	u64 changed = 0;
+	for (u32 i = 0; i < count; i++) {
+		changed += live_patch(g, live->copies[next], &updates[i]);
+	}
+	live->versions[next] = live->versions[old] + 1;
+	__atomic_store_n(&live->current, next, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&g->version, live->versions[next], __ATOMIC_RELEASE);
+
+	while (__atomic_load_n(&live->readers[old], __ATOMIC_SEQ_CST) > 0) {
+		sched_yield();
+	}
+	for (u32 i = 0; i < count; i++) {
+		live_patch(g, live->copies[old], &updates[i]);
+	}
+	live->versions[old] = live->versions[next];
+	live->edges_changed += changed;
+
+	release_lock(&live->writer);
+	return changed;
+}
+
+static u32 live_split(char *line, u64 len, StrView *fields, u32 max_fields) {
+	char separator = memchr(line, ',', len) ? ',' : ' ';
+	char *end = line + len;
+	u32 count = 0;
+	char *c = line;
+	while (c < end && count < max_fields) {
+		while (c < end && isspace((u8)*c)) {
+			c++;
+		}
+		if (c >= end) {
+			break;
+		}
+		char *start = c;
+		while (c < end && *c != separator && !(separator == ' ' && isspace((u8)*c))) {
+			c++;
+		}
+		char *stop = c;
+		while (stop > start && isspace((u8)stop[-1])) {
+			stop--;
+		}
+		fields[count++] = (StrView){ start, (u64)(stop - start) };
+		if (c < end) {
+			c++;
+		}
+	}
+	return count;
+}
+
+static u32 live_find_node(Graph *g, StrView station, StrView line) {
+	char key[MAX_KEY_LEN];
+	if (station.len > MAX_NAME_LEN || line.len > MAX_NAME_LEN) {
+		return NO_NODE;
+	}
+	u64 key_len = node_key_view(key, station, line);
+	void *id = hm_getn(g->node_ids, key, key_len);
+	return id ? VOIDID(id) : NO_NODE;
+}
+
+// Parses one "delay|close|open station line station line [minutes]" command
+char *live_parse(Graph *g, char *line, u64 len, LiveUpdate *update) {
+	StrView fields[7];
+	u32 count = live_split(line, len, fields, 7);
+	if (count < 5) {
+		return "update needs an action and two platforms";
+	}
+
+	StrView action = fields[0];
+	if (action.len == 5 && !memcmp(action.ptr, "delay", 5)) {
+		if (count != 6) {
+			return "delay needs a time in minutes";
+		}
+		char minutes[32];
+		u64 n = (fields[5].len < sizeof(minutes)) ? fields[5].len : sizeof(minutes) - 1;
+		memcpy(minutes, fields[5].ptr, n);
+		minutes[n] = 0;
+		char *rest;
+		update->delta = strtof(minutes, &rest);
+		if (rest == minutes || *rest) {
+			return "bad delay time";
+		}
+		update->kind = UPDATE_DELAY;
+	} else if (action.len == 5 && !memcmp(action.ptr, "close", 5) && count == 5) {
+		update->kind = UPDATE_CLOSE;
+	} else if (action.len == 4 && !memcmp(action.ptr, "open", 4) && count == 5) {
+		update->kind = UPDATE_OPEN;
+	} else {
+		return "unknown update";
+	}
+
+	update->from = live_find_node(g, fields[1], fields[2]);
+	update->to = live_find_node(g, fields[3], fields[4]);
+	if (update->from == NO_NODE || update->to == NO_NODE) {
+		return "unknown platform";
+	}
+	return NULL;
+}
+
+/*
+ * Parses and applies a ';' separated group of commands as one step, so
+ * queries see all of them or none. Returns an error and applies nothing if
+ * any command is bad.
+ */
+char *live_command(Graph *g, char *text, u64 len, u64 *changed) {
+	LiveUpdate updates[LIVE_MAX_UPDATES];
+	u32 count = 0;
+	char *end = text + len;
+	char *c = text;
+	while (c < end) {
+		char *stop = (char *)memchr(c, ';', end - c);
+		if (stop == NULL) {
+			stop = end;
+		}
+		if (count == LIVE_MAX_UPDATES) {
+			return "too many updates in one group";
+		}
+		char *error = live_parse(g, c, stop - c, &updates[count++]);
+		if (error) {
+			return error;
+		}
+		c = stop + 1;
+	}
+
+	*changed = live_apply(g, updates, count);
+	return NULL;
+}
+
+typedef struct LiveFollow {
+	Graph *g;
+	char *path;
+} LiveFollow;
+
+static void *live_follow_thread(void *arg) {
+	LiveFollow *follow = (LiveFollow *)arg;
+	FILE *file = fopen(follow->path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "could not open %s for updates!\n", follow->path);
+		free(follow);
+		return NULL;
+	}
+
+	char *line = NULL;
+	size_t capacity = 0;
+	ssize_t len;
+	while ((len = getline(&line, &capacity, file)) >= 0) {
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			len--;
+		}
+		if (len == 0) {
+			continue;
+		}
+		u64 changed = 0;
+		char *error = live_command(follow->g, line, len, &changed);
+		if (error) {
+			fprintf(stderr, "update \"%.*s\": %s\n", (int)len, line, error);
+		} else {
+			debug("[LIVE] %.*s: %llu edges\n", (int)len, line, changed);
+		}
+	}
+
+	free(line);
+	fclose(file);
+	free(follow);
+	return NULL;
+}
+
+// Applies update lines from a file or FIFO on a background thread until EOF
+void live_follow(Graph *g, char *path) {
+	LiveFollow *follow = (LiveFollow *)malloc(sizeof(LiveFollow));
+	follow->g = g;
+	follow->path = path;
+	pthread_t thread;
+	pthread_create(&thread, NULL, live_follow_thread, follow);
+	pthread_detach(thread);
+}
+
+#endif
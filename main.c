@@ -2,379 +2,740 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "common.h"
 #include "file_helper.h"
 #include "hashmap.h"
 #include "dynarr.h"
 #include "pqueue.h"
-
-#define FLOATVOID(x) ((void *)((u64)x))
-#define VOIDFLOAT(x) ((f32)((u64)x))
-
-char *file_next_line(File *file, u64 *idx) {
-	if (*idx >= file->size) {
+#include "graph.h"
+#include "arena.h"
+#include "snapshot.h"
+#include "router.h"
+#include "server.h"
+#include "batch.h"
+#include "landmarks.h"
+#include "hierarchy.h"
+#include "table.h"
+#include "timetable.h"
+#include "matrix.h"
+#include "generate.h"
+#include "bench.h"
+#include "prefix.h"
+
+#define STATION_FILE "stations.log"
+#define SNAPSHOT_FILE "stations.bin"
+#define HIERARCHY_FILE "stations.ch"
+#define TABLE_FILE "stations.table"
+
+Graph *parse_graph(char *station_path) {
+	File *station_file = map_file(station_path);
+	if (station_file == NULL) {
 		return NULL;
 	}
+	Graph *g = graph_build(station_file);
+	close_file(station_file);
+	return g;
+}
 
-	char *tmp_start = file->string + *idx;
-	char *tmp = tmp_start;
-	while ((*tmp != '\n') && (*tmp != '\0')) {
-		tmp++;
+// Prefers the compiled snapshot unless the station file has been edited since
+Graph *load_graph(char *station_path, char *snapshot_path) {
+	struct stat station_st;
+	struct stat snapshot_st;
+	bool have_station = stat(station_path, &station_st) == 0;
+	bool have_snapshot = stat(snapshot_path, &snapshot_st) == 0;
+
+	if (have_snapshot && (!have_station || snapshot_st.st_mtime >= station_st.st_mtime)) {
+		Graph *g = snapshot_load(snapshot_path, true);
+		if (g != NULL) {
+			return g;
+		}
+	} else if (have_snapshot) {
+		printf("%s is older than %s, parsing instead\n", snapshot_path, station_path);
 	}
-	tmp++;
 
-	u64 line_length = tmp - tmp_start;
-	char *line = (char *)malloc(line_length);
-	memcpy(line, tmp_start, line_length - 1);
-	line[line_length - 1] = 0;
+	return parse_graph(station_path);
+}
 
-	*idx += line_length;
+int compile_snapshot(char *station_path, char *snapshot_path) {
+	u64 start = get_time_ms();
+	Graph *g = parse_graph(station_path);
+	if (g == NULL) {
+		return 1;
+	}
 
-	return line;
+	bool ok = snapshot_write(g, snapshot_path);
+	if (ok) {
+		printf("compiled %s into %s: %u platforms, %u edges in %llu ms\n", station_path, snapshot_path, g->node_count, g->edge_count, get_time_ms() - start);
+	}
+	graph_free(g);
+	return ok ? 0 : 1;
 }
 
-DynArr *read_all_lines(File *file) {
-	DynArr *da = da_init();
-	u64 idx = 0;
+typedef struct Setup {
+	SearchOptions search;
+	u32 landmark_count;
+	LandmarkStrategy landmark_strategy;
+	bool use_hierarchy;
+	bool use_table;
+	char *timetable_path;
+} Setup;
+
+// Pulls the routing options out of argv, shifting the remaining arguments down
+bool parse_setup(int *argc, char **argv, Setup *setup) {
+	setup->search.mode = SEARCH_DIJKSTRA;
+	setup->search.landmarks = NULL;
+	setup->search.hierarchy = NULL;
+	setup->search.table = NULL;
+	setup->search.cache_bytes = 0;
+	setup->search.timetable = NULL;
+	setup->search.delta_width = 0;
+	setup->search.delta_threads = cpu_count();
+	setup->landmark_count = 0;
+	setup->landmark_strategy = LANDMARK_FARTHEST;
+	setup->use_hierarchy = false;
+	setup->use_table = false;
+	setup->timetable_path = NULL;
+
+	int kept = 0;
+	for (int i = 0; i < *argc; i++) {
+		if (!strcmp(argv[i], "--landmarks") && i + 1 < *argc) {
+			setup->landmark_count = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--bidirectional")) {
+			setup->search.mode = SEARCH_BIDIRECTIONAL;
+		} else if (!strcmp(argv[i], "--delta") && i + 1 < *argc) {
+			setup->search.mode = SEARCH_DELTA;
+			setup->search.delta_width = strtof(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "--delta-threads") && i + 1 < *argc) {
+			setup->search.delta_threads = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--cache") && i + 1 < *argc) {
+			setup->search.cache_bytes = (u64)atoi(argv[++i]) << 20;
+		} else if (!strcmp(argv[i], "--timetable") && i + 1 < *argc) {
+			setup->timetable_path = argv[++i];
+		} else if (!strcmp(argv[i], "--table")) {
+			setup->use_table = true;
+		} else if (!strcmp(argv[i], "--ch")) {
+			setup->use_hierarchy = true;
+		} else if (!strcmp(argv[i], "--strategy") && i + 1 < *argc) {
+			if (!parse_landmark_strategy(argv[++i], &setup->landmark_strategy)) {
+				printf("unknown landmark strategy %s\n", argv[i]);
+				return false;
+			}
+		} else {
+			argv[kept++] = argv[i];
+		}
+	}
+	*argc = kept;
+	return true;
+}
 
-	bool inserted = false;
-	do {
-		inserted = da_insert(da, file_next_line(file, &idx));
-	} while (inserted);
+// Maps the saved hierarchy, contracting and saving a fresh one if it is missing or stale
+Hierarchy *load_hierarchy(Graph *g, char *path) {
+	Hierarchy *ch = hierarchy_load(g, path);
+	if (ch != NULL) {
+		return ch;
+	}
 
-	return da;
+	u64 start = get_time_ms();
+	ch = hierarchy_build(g);
+	fprintf(stderr, "contracted %u platforms, %u shortcuts in %llu ms\n", ch->node_count, ch->shortcut_count, get_time_ms() - start);
+	hierarchy_write(ch, g, path);
+	return ch;
 }
 
-void print_lines(DynArr *da) {
-	for (u64 i = 0; i < da->size; i++) {
-		printf("[%llu] %s\n", i, (char *)(da->buffer[i]));
+RouteTable *load_table(Graph *g, char *path, u32 threads) {
+	RouteTable *table = table_load(g, path);
+	if (table != NULL) {
+		return table;
 	}
 
-	printf("\n");
+	u64 start = get_time_ms();
+	table = table_build(g, threads);
+	fprintf(stderr, "tabled %u stations on %u threads in %llu ms\n", table->station_count, threads, get_time_ms() - start);
+	table_write(table, g, path);
+	return table;
 }
 
-typedef struct Route {
-	DynArr *path;
-	HashMap *from_data;
-	HashMap *transit_times;
-	f32 accum_time;
-	char *start;
-	char *start_line;
-	char *end;
-	char *end_line;
-} Route;
-
-Route *new_route(DynArr *path, HashMap *from_data, HashMap *transit_times, f32 accum_time, char *start, char *start_line, char *end, char *end_line) {
-	Route *route = (Route *)malloc(sizeof(Route));
-	route->path = path;
-	route->from_data = from_data;
-	route->transit_times = transit_times;
-	route->accum_time = accum_time;
-	route->start = start;
-	route->start_line = start_line;
-	route->end = end;
-	route->end_line = end_line;
-	return route;
+bool setup_build(Graph *g, Setup *setup) {
+	setup->search.names = prefix_build(g);
+	if (setup->timetable_path != NULL) {
+		u64 start = get_time_ms();
+		setup->search.timetable = timetable_load(g, setup->timetable_path);
+		if (setup->search.timetable == NULL) {
+			return false;
+		}
+		Timetable *tt = setup->search.timetable;
+		fprintf(stderr, "loaded %u trips on %u patterns in %llu ms\n", tt->trip_count, tt->pattern_count, get_time_ms() - start);
+	}
+	if (setup->use_table) {
+		setup->search.table = load_table(g, TABLE_FILE, cpu_count());
+		setup->search.mode = SEARCH_TABLE;
+	}
+	if (setup->use_hierarchy) {
+		setup->search.hierarchy = load_hierarchy(g, HIERARCHY_FILE);
+		setup->search.mode = SEARCH_CH;
+	}
+	if (setup->landmark_count > 0) {
+		u64 start = get_time_ms();
+		setup->search.landmarks = landmarks_build(g, setup->landmark_count, setup->landmark_strategy, 0);
+		setup->search.mode = SEARCH_ALT;
+		fprintf(stderr, "built %u landmarks in %llu ms\n", setup->search.landmarks->count, get_time_ms() - start);
+	}
+	return true;
 }
 
-typedef struct StationNode {
-	char *name;
-	char *line;
-	DynArr *conn;
-} StationNode;
-
-typedef struct ConnNode {
-	StationNode *station;
-	f32 time;
-} ConnNode;
-
-void free_route(Route *route) {
-	hm_free(route->transit_times);
-	hm_free(route->from_data);
-
-	if (route->path != NULL) {
-		da_free(route->path);
+void setup_free(Setup *setup) {
+	if (setup->search.landmarks != NULL) {
+		landmarks_free(setup->search.landmarks);
+	}
+	if (setup->search.hierarchy != NULL) {
+		hierarchy_free(setup->search.hierarchy);
+	}
+	if (setup->search.table != NULL) {
+		table_free(setup->search.table);
+	}
+	if (setup->search.timetable != NULL) {
+		timetable_free(setup->search.timetable);
+	}
+	if (setup->search.names != NULL) {
+		prefix_free(setup->search.names);
 	}
-	free(route);
 }
 
-StationNode *new_station(char *name, char *line) {
-	StationNode *node = (StationNode *)malloc(sizeof(StationNode));
-	node->name = strdup(name);
-	node->line = strdup(line);
-	node->conn = da_init();
-	return node;
-}
+int run_demo(Graph *g, Setup *setup) {
+	SearchContext *ctx = search_init(g->node_count);
+	search_configure(ctx, &setup->search);
 
-void free_station(StationNode *node) {
-	free(node->name);
-	free(node->line);
-	da_free(node->conn);
-	free(node);
-}
+	for (u64 i = 0; i < 1; i++) {
+		Route *route = find_best_route(g, ctx, "G", "Z");
+		if (route == NULL) {
+			printf("Unknown station!\n");
+			break;
+		}
+		print_route(g, route);
+	}
 
-char *station_lookup(char *station, char *line) {
-	char *lookup_str = calloc(strlen(station) + strlen(line) + 2, sizeof(char));
-	strcat(lookup_str, station);
-	strcat(lookup_str, "~");
-	strcat(lookup_str, line);
-	return lookup_str;
-}
+	Timetable *tt = setup->search.timetable;
+	if (tt != NULL) {
+		RaptorState *rs = raptor_init(tt);
+		char *departures[2] = { "08:14", "08:20" };
+		for (u32 i = 0; i < 2; i++) {
+			u32 depart = parse_clock((StrView){ departures[i], strlen(departures[i]) });
+			Route *route = find_timetable_route(g, tt, rs, ctx, "G", "Z", depart);
+			printf("\nleaving at %s:\n", departures[i]);
+			print_route(g, route);
+		}
+		raptor_free(rs);
+	}
 
-ConnNode *new_connection(StationNode *station, f32 time) {
-	ConnNode *node = (ConnNode *)malloc(sizeof(ConnNode));
-	node->station = station;
-	node->time = time;
-	return node;
+	search_free(ctx);
+	return 0;
 }
 
-void print_connections(DynArr *conn) {
-	for (u64 i = 0; i < conn->size; i++) {
-		ConnNode *node = (ConnNode *)(conn->buffer[i]);
-		printf("%s %s in %.2gs\n", node->station->line, node->station->name, node->time);
+int serve_command(Graph *g, Setup *setup, int argc, char **argv) {
+	char *unix_path = NULL;
+	char *updates_path = NULL;
+	u16 port = 0;
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--socket") && i + 1 < argc) {
+			unix_path = argv[++i];
+		} else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+			port = (u16)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--updates") && i + 1 < argc) {
+			updates_path = argv[++i];
+		} else {
+			printf("unknown serve option %s\n", argv[i]);
+			return 1;
+		}
 	}
-	puts("");
+	int ret = run_server(g, &setup->search, unix_path, port, updates_path);
+	live_free(g);
+	return ret;
 }
 
-void print_station_list(DynArr *station_list) {
-	for (u64 i = 0; i < station_list->size; i++) {
-		StationNode *station = (StationNode *)(station_list->buffer[i]);
-		printf("%s %s\n", station->line, station->name);
-	}
+void usage() {
+	printf("usage: tram_paths                      route G -> Z once\n");
+	printf("       tram_paths compile [log] [bin]  write a binary snapshot\n");
+	printf("       tram_paths generate grid|radial|random stations [--lines k] [--seed s] file\n");
+	printf("                                      write a synthetic network in stations.log format\n");
+	printf("       tram_paths bench [--queries n] [--seed s] [file]\n");
+	printf("                                      time load, graph build, preprocessing and queries\n");
+	printf("       tram_paths serve [--socket path | --port n] [--updates file]\n");
+	printf("                                      answer JSON lines from stdin or a socket,\n");
+	printf("                                      applying delay/close/open lines from file\n");
+	printf("       tram_paths batch file [--threads n]\n");
+	printf("                                      answer a file of JSON lines in parallel\n");
+	printf("       tram_paths matrix sources targets [--threads n]\n");
+	printf("                                      travel times between two station lists\n");
+	printf("       tram_paths isochrone station minutes\n");
+	printf("                                      list every station within a time budget\n");
+	printf("       tram_paths complete prefix [limit]\n");
+	printf("                                      stations whose names start with prefix\n");
+	printf("       tram_paths compare [--queries n]\n");
+	printf("                                      compare the chosen routing mode with Dijkstra\n");
+	printf("       tram_paths landmarks [--queries n]\n");
+	printf("                                      compare nodes settled by ALT and Dijkstra\n");
+	printf("       tram_paths contract [--queries n]\n");
+	printf("                                      rebuild the contraction hierarchy and compare\n");
+	printf("       tram_paths timetable --timetable file [--queries n]\n");
+	printf("                                      time the scheduled engine on random queries\n");
+	printf("       tram_paths table [--threads n] [--queries n]\n");
+	printf("                                      rebuild the all-pairs route table and compare\n");
+	printf("\n");
+	printf("routing options, for any command:\n");
+	printf("  --landmarks k         route with A* over k ALT landmarks\n");
+	printf("  --strategy s          landmark selection: farthest (default) or random\n");
+	printf("  --bidirectional       search from both ends at once, no preprocessing\n");
+	printf("  --delta width         parallel delta-stepping with buckets this many minutes wide,\n");
+	printf("                        0 for the mean edge time\n");
+	printf("  --delta-threads n     threads per delta-stepping search (default: all cores)\n");
+	printf("  --ch                  route over the contraction hierarchy in %s\n", HIERARCHY_FILE);
+	printf("  --cache mb            keep an LRU cache of finished routes per worker\n");
+	printf("  --timetable file      answer queries with a departure time from this schedule\n");
+	printf("  --table               answer from the all-pairs route table in %s\n", TABLE_FILE);
 }
 
-void print_station_map(HashMap *hm) {
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-		StationNode *station = ((StationNode *)bucket->data);
-		if (station != NULL) {
-			printf("Station %s | %s\n---------\n", station->name, station->line);
-			print_connections(station->conn);
-
-			while (bucket->next != NULL) {
-				StationNode *station = ((StationNode *)bucket->next->data);
-				printf("Station %s | %s\n---------\n", station->name, station->line);
-				print_connections(station->conn);
-				bucket = bucket->next;
-			}
+int batch_command(Graph *g, Setup *setup, int argc, char **argv) {
+	char *path = NULL;
+	u32 threads = cpu_count();
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = (u32)atoi(argv[++i]);
+		} else if (path == NULL) {
+			path = argv[i];
+		} else {
+			printf("unknown batch option %s\n", argv[i]);
+			return 1;
 		}
 	}
+	if (path == NULL || threads == 0) {
+		usage();
+		return 1;
+	}
+	return run_batch(g, &setup->search, path, threads);
 }
 
-void print_station_names(HashMap *hm) {
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-		StationNode *station = ((StationNode *)bucket->data);
-		printf("Station %s | %s\n", station->name, station->line);
-		while (bucket->next != NULL) {
-			StationNode *station = ((StationNode *)bucket->data);
-			printf("Station %s | %s\n", station->name, station->line);
-			bucket = bucket->next;
+bool parse_queries(int argc, char **argv, u32 *queries) {
+	*queries = 1000;
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--queries") && i + 1 < argc) {
+			*queries = (u32)atoi(argv[++i]);
+		} else {
+			printf("unknown option %s\n", argv[i]);
+			return false;
 		}
 	}
+	return true;
 }
 
-DynArr *flatten_map_keys(HashMap *hm) {
-	DynArr *flat = da_init();
-	for (u64 i = 0; i < hm->idx_map_size; i++) {
-		HMNode *bucket = hm->map[hm->idx_map[i]];
-		da_insert(flat, bucket->key);
-		while (bucket->next != NULL) {
-			da_insert(flat, bucket->next->key);
-			bucket = bucket->next;
-		}
+int landmarks_command(Graph *g, Setup *setup, int argc, char **argv) {
+	u32 queries;
+	if (!parse_queries(argc, argv, &queries)) {
+		return 1;
 	}
 
-	return flat;
+	if (setup->search.landmarks == NULL) {
+		setup->search.landmarks = landmarks_build(g, 8, setup->landmark_strategy, 0);
+	}
+	setup->search.mode = SEARCH_ALT;
+	printf("%u landmarks\n", setup->search.landmarks->count);
+	return search_report(g, &setup->search, queries, 0);
 }
 
-Route *find_route(HashMap *map, char *start, char *start_line, char *end, char *end_line) {
-	char *start_lookup = station_lookup(start, start_line);
-	char *end_lookup = station_lookup(end, end_line);
-    StationNode *start_station = hm_get(map, start_lookup);
-    StationNode *end_station = hm_get(map, end_lookup);
-
-	PriorityQueue *frontier = pq_init();
-	pq_push(frontier, hm_get(map, start_lookup), 0);
-
-	HashMap *from = hm_init();
-	HashMap *accrued_cost = hm_init();
-
-	hm_insert(&from, start_lookup, NULL);
-	hm_insert(&accrued_cost, start_lookup, FLOATVOID(0.0f));
-
-	while (frontier->heap->size > 0) {
-		StationNode *current = pq_pop(frontier);
-
-		if (current == end_station) {
-			break;
-		}
-
-		for (u64 i = 0; i < current->conn->size; i++) {
-			ConnNode *next_conn = ((ConnNode *)current->conn->buffer[i]);
-
-			char *current_lookup = station_lookup(current->name, current->line);
-			char *next_lookup = station_lookup(next_conn->station->name, next_conn->station->line);
+int compare_command(Graph *g, Setup *setup, int argc, char **argv) {
+	u32 queries;
+	if (!parse_queries(argc, argv, &queries)) {
+		return 1;
+	}
+	return search_report(g, &setup->search, queries, 0);
+}
 
-			f32 new_cost = VOIDFLOAT(hm_get(accrued_cost, current_lookup)) + next_conn->time;
+int contract_command(Graph *g, Setup *setup, int argc, char **argv) {
+	u32 queries;
+	if (!parse_queries(argc, argv, &queries)) {
+		return 1;
+	}
 
-			if (hm_get(accrued_cost, next_lookup) == NULL || new_cost < VOIDFLOAT(hm_get(accrued_cost, next_lookup))) {
-				hm_insert(&accrued_cost, next_lookup, FLOATVOID(new_cost));
-				pq_push(frontier, next_conn->station, new_cost);
-				hm_insert(&from, next_lookup, current);
-			}
+	if (setup->search.hierarchy != NULL) {
+		hierarchy_free(setup->search.hierarchy);
+	}
+	u64 start = get_time_ms();
+	Hierarchy *ch = hierarchy_build(g);
+	setup->search.hierarchy = ch;
+	setup->search.mode = SEARCH_CH;
+	printf("contracted %u platforms into %u edges (%u shortcuts) in %llu ms\n", ch->node_count, ch->edge_count, ch->shortcut_count, get_time_ms() - start);
+	if (!hierarchy_write(ch, g, HIERARCHY_FILE)) {
+		return 1;
+	}
+	return search_report(g, &setup->search, queries, 0);
+}
 
-			free(current_lookup);
-			free(next_lookup);
+int table_command(Graph *g, Setup *setup, int argc, char **argv) {
+	u32 threads = cpu_count();
+	u32 queries = 1000;
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--queries") && i + 1 < argc) {
+			queries = (u32)atoi(argv[++i]);
+		} else {
+			printf("unknown table option %s\n", argv[i]);
+			return 1;
 		}
 	}
+	if (threads == 0) {
+		usage();
+		return 1;
+	}
 
-	char *current_lookup = station_lookup(end_station->name, end_station->line);
-	f32 accum_time = VOIDFLOAT(hm_get(accrued_cost, current_lookup));
-
-	free(start_lookup);
-	free(end_lookup);
-	free(current_lookup);
-	pq_free(frontier);
-
-	return new_route(NULL, from, accrued_cost, accum_time, start, start_line, end, end_line);
+	if (setup->search.table != NULL) {
+		table_free(setup->search.table);
+	}
+	u64 start = get_time_ms();
+	RouteTable *table = table_build(g, threads);
+	setup->search.table = table;
+	setup->search.mode = SEARCH_TABLE;
+	printf("tabled %u stations x %u platforms on %u threads in %llu ms\n", table->station_count, table->node_count, threads, get_time_ms() - start);
+	if (!table_write(table, g, TABLE_FILE)) {
+		return 1;
+	}
+	return search_report(g, &setup->search, queries, 0);
 }
 
-Route *find_best_route(HashMap *map, DynArr *line_list, char *start, char *end) {
-	DynArr *start_options = da_init();
-	DynArr *end_options = da_init();
+// One station name per line; blank lines are skipped
+u32 *read_station_list(Graph *g, char *path, u32 *count) {
+	File *file = read_file(path);
+	if (file == NULL) {
+		return NULL;
+	}
 
-	for (u64 i = 0; i < line_list->size; i++) {
-    	char *current_start_lookup = station_lookup(start, ((char *)line_list->buffer[i]));
-    	char *current_end_lookup = station_lookup(end, ((char *)line_list->buffer[i]));
-		if (hm_get(map, current_start_lookup) != NULL) {
-			da_insert(start_options, line_list->buffer[i]);
+	u32 capacity = 64;
+	u32 *stations = (u32 *)malloc(sizeof(u32) * capacity);
+	*count = 0;
+	char *line = strtok(file->string, "\r\n");
+	for (; line != NULL; line = strtok(NULL, "\r\n")) {
+		if (*line == 0) {
+			continue;
 		}
-		if (hm_get(map, current_end_lookup) != NULL) {
-			da_insert(end_options, line_list->buffer[i]);
+		u32 station = graph_find_station(g, line);
+		if (station == NO_NODE) {
+			printf("unknown station %s in %s\n", line, path);
+			free(stations);
+			close_file(file);
+			return NULL;
 		}
-		free(current_start_lookup);
-		free(current_end_lookup);
+		if (*count == capacity) {
+			capacity *= 2;
+			stations = (u32 *)realloc(stations, sizeof(u32) * capacity);
+		}
+		stations[(*count)++] = station;
 	}
+	close_file(file);
+	return stations;
+}
 
-	DynArr *route_options = da_init();
-	for (u64 i = 0; i < start_options->size; i++) {
-		for (u64 j = 0; j < end_options->size; j++) {
-			da_insert(route_options, find_route(map, start, start_options->buffer[i], end, end_options->buffer[j]));
+// Writes the matrix as tab separated values with station names along both edges
+int matrix_command(Graph *g, Setup *setup, int argc, char **argv) {
+	char *paths[2] = { NULL, NULL };
+	u32 threads = cpu_count();
+	u32 path_count = 0;
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+			threads = (u32)atoi(argv[++i]);
+		} else if (path_count < 2) {
+			paths[path_count++] = argv[i];
+		} else {
+			printf("unknown matrix option %s\n", argv[i]);
+			return 1;
 		}
 	}
+	if (path_count != 2 || threads == 0) {
+		usage();
+		return 1;
+	}
 
-	da_free(start_options);
-	da_free(end_options);
-
-	Route *best = route_options->buffer[0];
-	for (u64 i = 0; i < route_options->size; i++) {
-		Route *new = route_options->buffer[i];
-		if (best->accum_time > new->accum_time) {
-			best = new;
-		}
+	u32 source_count;
+	u32 target_count;
+	u32 *sources = read_station_list(g, paths[0], &source_count);
+	u32 *targets = (sources != NULL) ? read_station_list(g, paths[1], &target_count) : NULL;
+	if (targets == NULL) {
+		free(sources);
+		return 1;
 	}
 
-	for (u64 i = 0; i < route_options->size; i++) {
-		Route *cur = ((Route *)route_options->buffer[i]);
-		if (cur != best) {
-			free_route(cur);
+	u64 settled;
+	u64 start = get_time_ms();
+	f32 *times = travel_matrix(g, &setup->search, sources, source_count, targets, target_count, threads, &settled);
+	u64 elapsed = get_time_ms() - start;
+
+	StrBuf *out = sb_init();
+	for (u32 j = 0; j < target_count; j++) {
+		sb_printf(out, "\t%s", station_name(g, targets[j]));
+	}
+	sb_puts(out, "\n");
+	for (u32 i = 0; i < source_count; i++) {
+		sb_puts(out, station_name(g, sources[i]));
+		for (u32 j = 0; j < target_count; j++) {
+			sb_printf(out, "\t%g", times[(u64)i * target_count + j]);
 		}
+		sb_puts(out, "\n");
 	}
+	bool ok = write_all(STDOUT_FILENO, out->buffer, out->size);
+
+	bool buckets = setup->search.hierarchy != NULL && setup->search.hierarchy->version == g->version;
+	fprintf(stderr, "%u x %u matrix (%s) on %u threads in %llu ms, %llu platforms settled\n",
+		source_count, target_count, buckets ? "hierarchy buckets" : "dijkstra", threads, elapsed, settled);
+#ifdef TRAM_STATS
+	// travel_matrix folds its workers' counters into this thread's
+	sb_clear(out);
+	stats_write_json(out, &tram_stats);
+	fprintf(stderr, "counters: %.*s\n", (int)out->size, out->buffer);
+#endif
+
+	sb_free(out);
+	free(times);
+	free(sources);
+	free(targets);
+	return ok ? 0 : 1;
+}
 
-	free(route_options->buffer);
-	free(route_options);
+static void print_isochrone_station(void *arg, u32 node, f32 time) {
+	Graph *g = (Graph *)arg;
+	printf("  %6.2f  %s %s\n", time, node_name(g, node), node_line_name(g, node));
+}
 
-	// Fill walkable path for best route
-	DynArr *path = da_init();
-	char *start_lookup = station_lookup(start, best->start_line);
-	char *end_lookup = station_lookup(end, best->end_line);
-    StationNode *start_station = hm_get(map, start_lookup);
-    StationNode *end_station = hm_get(map, end_lookup);
-	da_insert(path, end_station);
-	da_insert(path, end_station);
+int isochrone_command(Graph *g, Setup *setup, int argc, char **argv) {
+	if (argc != 2) {
+		usage();
+		return 1;
+	}
+	char *rest;
+	f32 minutes = strtof(argv[1], &rest);
+	if (rest == argv[1] || *rest || !(minutes >= 0)) {
+		printf("bad time budget %s\n", argv[1]);
+		return 1;
+	}
+
+	SearchContext *ctx = search_init(g->node_count);
+	search_configure(ctx, &setup->search);
+	u64 start = common_rdtsc();
+	u32 count = find_isochrone(g, ctx, argv[0], minutes, print_isochrone_station, g);
+	u64 cycles = common_rdtsc() - start;
+	if (count == NO_NODE) {
+		printf("Unknown station!\n");
+	} else {
+		printf("%u stations within %g minutes of %s, %llu nodes settled, %llu cycles\n", count, minutes, argv[0], ctx->settled, cycles);
+	}
+	search_free(ctx);
+	return (count == NO_NODE) ? 1 : 0;
+}
 
-	free(start_lookup);
-	free(end_lookup);
+int complete_command(Graph *g, Setup *setup, int argc, char **argv) {
+	if (argc < 1 || argc > 2) {
+		usage();
+		return 1;
+	}
+	u32 limit = (argc > 1) ? (u32)atoi(argv[1]) : 10;
+
+	u32 stations[PREFIX_MAX_LIMIT];
+	u64 start = common_rdtsc();
+	u32 count = prefix_complete(setup->search.names, g, argv[0], strlen(argv[0]), stations, limit);
+	u64 cycles = common_rdtsc() - start;
+	for (u32 i = 0; i < count; i++) {
+		u32 s = stations[i];
+		printf("%s\t", station_name(g, s));
+		for (u32 k = g->station_offsets[s]; k < g->station_offsets[s + 1]; k++) {
+			printf((k == g->station_offsets[s]) ? "%s" : " %s", node_line_name(g, g->station_nodes[k]));
+		}
+		printf("\n");
+	}
+	printf("%u stations starting with \"%s\", %llu cycles\n", count, argv[0], cycles);
+	return 0;
+}
 
-	StationNode *current = end_station;
-	while (current != start_station) {
-		char *current_lookup = station_lookup(current->name, current->line);
-		current = hm_get(best->from_data, current_lookup);
-        free(current_lookup);
+// Random station pairs at random times of day through the timetable engine
+int timetable_command(Graph *g, Setup *setup, int argc, char **argv) {
+	u32 queries;
+	if (!parse_queries(argc, argv, &queries)) {
+		return 1;
+	}
+	Timetable *tt = setup->search.timetable;
+	if (tt == NULL || g->station_count == 0) {
+		printf("timetable needs --timetable file\n");
+		return 1;
+	}
 
-		da_insert(path, current);
+	SearchContext *ctx = search_init(g->node_count);
+	RaptorState *rs = raptor_init(tt);
+	u64 rng = 1;
+	u64 cycles = 0;
+	u64 rounds = 0;
+	u32 reached = 0;
+	u64 start = get_time_ms();
+	for (u32 q = 0; q < queries; q++) {
+		char *from = station_name(g, rng_next(&rng) % g->station_count);
+		char *to = station_name(g, rng_next(&rng) % g->station_count);
+		u32 depart = (5 * 3600) + (rng_next(&rng) % (18 * 3600));
+
+		u64 before = common_rdtsc();
+		Route *route = find_timetable_route(g, tt, rs, ctx, from, to, depart);
+		cycles += common_rdtsc() - before;
+		rounds += rs->rounds;
+		reached += route->path != NULL;
 	}
-	best->path = path;
+	u64 elapsed = get_time_ms() - start;
 
-	return best;
-}
+	printf("%u trips on %u patterns, %u random queries between 05:00 and 23:00\n", tt->trip_count, tt->pattern_count, queries);
+	printf("  %.0f cycles/query, %.1f us/query, %.1f rounds/query, %u reached\n",
+		(f64)cycles / queries, (elapsed * 1000.0) / queries, (f64)rounds / queries, reached);
 
-void print_route(Route *route) {
-	printf("-------------\n");
-	printf("Trip Summary\n");
-	printf("   %s -> %s\n", route->start, route->end);
-	printf("-------------\n\n");
-	for (u64 i = route->path->size - 1; i > 0; i--) {
-		StationNode *current = (StationNode *)route->path->buffer[i];
-		printf("  %s %s\n", current->name, current->line);
-	}
-	printf("\ntravel time: %.2g minutes\n", route->accum_time);
-	printf("-----------------------\n");
+	raptor_free(rs);
+	search_free(ctx);
+	return 0;
 }
 
-int main() {
-	File *station_file = read_file("stations.log");
-	DynArr *file_lines = read_all_lines(station_file);
-	HashMap *map = hm_init();
-	HashMap *line_map = hm_init();
-	HashMap *station_map = hm_init();
-
-	for (u64 i = 0; i < file_lines->size; i++) {
-		char station1[257] = {0};
-		char station2[257] = {0};
-		char line1[257] = {0};
-		char line2[257] = {0};
-		sscanf((char *)(file_lines->buffer[i]), "%256[^','], %256[^','], %256[^','], %256[^','], %*s", station1, line1, station2, line2);
+int generate_command(int argc, char **argv) {
+	GenerateKind kind;
+	u32 stations = 0;
+	u32 lines = 0;
+	u64 seed = 1;
+	char *path = NULL;
+	if (argc < 2 || !parse_generate_kind(argv[0], &kind)) {
+		usage();
+		return 1;
+	}
+	stations = (u32)atoi(argv[1]);
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--lines") && i + 1 < argc) {
+			lines = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (i == argc - 1) {
+			path = argv[i];
+		} else {
+			printf("unknown generate option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	// Never default to STATION_FILE, which would overwrite the sample network
+	if (path == NULL) {
+		usage();
+		return 1;
+	}
+	if (stations < 2) {
+		printf("a network needs at least 2 stations\n");
+		return 1;
+	}
+	return generate_network(kind, stations, lines, seed, path) ? 0 : 1;
+}
 
-		char *lookup1 = station_lookup(station1, line1);
-		char *lookup2 = station_lookup(station2, line2);
+// Times each stage from the raw station file through preprocessing and queries
+int bench_command(Setup *setup, int argc, char **argv) {
+	char *path = STATION_FILE;
+	u32 queries = 10000;
+	u64 seed = 1;
+	for (int i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--queries") && i + 1 < argc) {
+			queries = (u32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 10);
+		} else if (i == argc - 1) {
+			path = argv[i];
+		} else {
+			printf("unknown bench option %s\n", argv[i]);
+			return 1;
+		}
+	}
 
-		StationNode *station_node1 = new_station(station1, line1);
-		StationNode *station_node2 = new_station(station2, line2);
+	u64 start = get_time_ms();
+	File *file = map_file(path);
+	if (file == NULL) {
+		return 1;
+	}
+	u64 loaded = get_time_ms();
+	Graph *g = graph_build(file);
+	u64 built = get_time_ms();
+	u64 bytes = file->size;
+	close_file(file);
+	if (!setup_build(g, setup)) {
+		setup_free(setup);
+		graph_free(g);
+		return 1;
+	}
+	u64 prepared = get_time_ms();
 
-		hm_insert(&map, lookup1, station_node1);
-		hm_insert(&map, lookup2, station_node2);
+	printf("%s: %u stations, %u platforms, %u edges, %s routing\n", path, g->station_count, g->node_count, g->edge_count, search_mode_name(setup->search.mode));
+	printf("  load:        %llu ms (%llu bytes)\n", loaded - start, bytes);
+	printf("  graph build: %llu ms\n", built - loaded);
+	printf("  preprocess:  %llu ms\n", prepared - built);
+	bench_queries(g, &setup->search, queries, seed);
 
-		hm_insert(&line_map, line1, (void *)1);
-		hm_insert(&line_map, line2, (void *)1);
+	setup_free(setup);
+	graph_free(g);
+	return 0;
+}
 
-		hm_insert(&station_map, station1, (void *)1);
-		hm_insert(&station_map, station2, (void *)1);
+int main(int argc, char **argv) {
+	Setup setup;
+	if (!parse_setup(&argc, argv, &setup)) {
+		return 1;
 	}
 
-	for (u64 i = 0; i < file_lines->size; i++) {
-		char station1[257] = {0};
-		char station2[257] = {0};
-		char time[257] = {0};
-		char line1[257] = {0};
-		char line2[257] = {0};
-		sscanf((char *)(file_lines->buffer[i]), "%256[^','], %256[^','], %256[^','], %256[^','], %256s", station1, line1, station2, line2, time);
+	char *command = (argc > 1) ? argv[1] : NULL;
+	if (command != NULL && !strcmp(command, "compile")) {
+		char *station_path = (argc > 2) ? argv[2] : STATION_FILE;
+		char *snapshot_path = (argc > 3) ? argv[3] : SNAPSHOT_FILE;
+		return compile_snapshot(station_path, snapshot_path);
+	}
+	if (command != NULL && !strcmp(command, "generate")) {
+		return generate_command(argc - 2, argv + 2);
+	}
+	if (command != NULL && !strcmp(command, "bench")) {
+		return bench_command(&setup, argc - 2, argv + 2);
+	}
+	if (command != NULL && strcmp(command, "serve") && strcmp(command, "batch") && strcmp(command, "landmarks") && strcmp(command, "contract") && strcmp(command, "compare") && strcmp(command, "table") && strcmp(command, "timetable") && strcmp(command, "isochrone") && strcmp(command, "matrix") && strcmp(command, "complete")) {
+		usage();
+		return 1;
+	}
 
-		char *lookup1 = station_lookup(station1, line1);
-		char *lookup2 = station_lookup(station2, line2);
-		da_insert(((StationNode *)hm_get(map, lookup1))->conn, new_connection(hm_get(map, lookup2), strtof(time, NULL)));
-	    da_insert(((StationNode *)hm_get(map, lookup2))->conn, new_connection(hm_get(map, lookup1), strtof(time, NULL)));
+	Graph *g = load_graph(STATION_FILE, SNAPSHOT_FILE);
+	if (g == NULL) {
+		return 1;
 	}
 
-	DynArr *line_list = flatten_map_keys(line_map);
+	if (!setup_build(g, &setup)) {
+		setup_free(&setup);
+		graph_free(g);
+		return 1;
+	}
 
-	for (u64 i = 0; i < 1; i++) {
-		Route *route = find_best_route(map, line_list, "G", "Z");
-		print_route(route);
-		free_route(route);
+	int ret;
+	if (command == NULL) {
+		ret = run_demo(g, &setup);
+	} else if (!strcmp(command, "serve")) {
+		ret = serve_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "batch")) {
+		ret = batch_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "compare")) {
+		ret = compare_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "landmarks")) {
+		ret = landmarks_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "timetable")) {
+		ret = timetable_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "isochrone")) {
+		ret = isochrone_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "complete")) {
+		ret = complete_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "matrix")) {
+		ret = matrix_command(g, &setup, argc - 2, argv + 2);
+	} else if (!strcmp(command, "table")) {
+		ret = table_command(g, &setup, argc - 2, argv + 2);
+	} else {
+		ret = contract_command(g, &setup, argc - 2, argv + 2);
 	}
 
-	return 0;
+	setup_free(&setup);
+	graph_free(g);
+	return ret;
 }
@@ -0,0 +1,312 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <math.h>
+
+#include "common.h"
+#include "graph.h"
+#include "router.h"
+#include "pool.h"
+
+/*
+ * Origin x destination travel time matrices, returned as one flat f32 array
+ * with times[i * target_count + j] the trip time from sources[i] to
+ * targets[j] (INFINITY when unreachable). No Route is built for any cell.
+ *
+ * With a current contraction hierarchy the matrix is bucket based: one
+ * upward search from every target leaves (column, cost) entries in a bucket
+ * at each platform it settles, then one upward search from every source
+ * scans the buckets of the platforms it settles. Every shortest path peaks
+ * at a platform both searches reach, so S + T small searches replace S * T
+ * queries. Without one, each source runs a single Dijkstra that stops once
+ * every target station has settled. Either way the searches are split
+ * across a worker pool, one SearchContext per worker, all running on the
+ * same copy of the edge times.
+ */
+
+#define MATRIX_CHUNK 4
+
+typedef struct MatrixBucket {
+	u32 column;
+	f32 time;
+} MatrixBucket;
+
+// Upward search spaces recorded by one worker in the bucket phase
+typedef struct MatrixSpace {
+	u32 *nodes;
+	f32 *costs;
+	u64 size;
+	u64 capacity;
+} MatrixSpace;
+
+typedef struct MatrixBuild {
+	Graph *g;
+	Hierarchy *ch;
+	u32 *sources;
+	u32 source_count;
+	u32 *targets;
+	u32 target_count;
+	f32 *times;
+	SearchContext **workers;
+
+	// bucket phase: column j's search space is spaces[space_worker[j]] from space_begin[j] to space_end[j]
+	MatrixSpace *spaces;
+	u32 *space_worker;
+	u64 *space_begin;
+	u64 *space_end;
+	u32 *bucket_offsets;
+	MatrixBucket *buckets;
+
+	// forward phase: which stations are targets and how many distinct ones
+	u8 *is_target;
+	u32 target_stations;
+	u32 **reached;
+
+	// platforms settled by each worker over all its searches
+	u64 *settled;
+	// per worker counters, see stats.h
+	QueryStats *stats;
+} MatrixBuild;
+
+static void matrix_seed(Graph *g, SearchContext *ctx, u32 station) {
+	search_begin(ctx, g);
+	search_seed(ctx, g->station_nodes + g->station_offsets[station], g->station_offsets[station + 1] - g->station_offsets[station]);
+}
+
+// Pops the next platform of an upward search and relaxes its upward edges
+static u32 matrix_upward_step(Hierarchy *ch, SearchContext *ctx) {
+	u32 current = ih_pop(ctx->frontier, NULL);
+	ctx->settled++;
+
+	f32 current_cost = ctx->cost[current];
+	for (u32 e = ch->up_offsets[current]; e < ch->up_offsets[current + 1]; e++) {
+		u32 next = ch->up_targets[e];
+		f32 new_cost = current_cost + ch->up_weights[e];
+		STAT_ADD(edges_relaxed, 1);
+		if (new_cost < search_cost(ctx, next)) {
+			search_set(ctx, next, new_cost, e);
+			ih_push(ctx->frontier, next, new_cost);
+		}
+	}
+	return current;
+}
+
+static void matrix_backward_worker(void *arg, u32 worker, u64 begin, u64 end) {
+	MatrixBuild *build = (MatrixBuild *)arg;
+	SearchContext *ctx = build->workers[worker];
+	MatrixSpace *space = &build->spaces[worker];
+	STAT_MARK(mark);
+
+	for (u64 j = begin; j < end; j++) {
+		build->space_worker[j] = worker;
+		build->space_begin[j] = space->size;
+		matrix_seed(build->g, ctx, build->targets[j]);
+		while (ctx->frontier->size > 0) {
+			u32 node = matrix_upward_step(build->ch, ctx);
+			if (space->size == space->capacity) {
+				space->capacity = (space->capacity > 0) ? space->capacity * 2 : 1024;
+				space->nodes = (u32 *)realloc(space->nodes, sizeof(u32) * space->capacity);
+				space->costs = (f32 *)realloc(space->costs, sizeof(f32) * space->capacity);
+			}
+			space->nodes[space->size] = node;
+			space->costs[space->size] = ctx->cost[node];
+			space->size++;
+		}
+		build->space_end[j] = space->size;
+		build->settled[worker] += ctx->settled;
+		STAT_ADD(nodes_settled, ctx->settled);
+	}
+	STAT_MOVE(&build->stats[worker], mark);
+}
+
+// Groups the recorded search spaces by platform, in column order
+static void matrix_fill_buckets(MatrixBuild *build) {
+	u32 node_count = build->g->node_count;
+	build->bucket_offsets = (u32 *)calloc(node_count + 1, sizeof(u32));
+	u64 total = 0;
+	for (u32 j = 0; j < build->target_count; j++) {
+		MatrixSpace *space = &build->spaces[build->space_worker[j]];
+		for (u64 k = build->space_begin[j]; k < build->space_end[j]; k++) {
+			build->bucket_offsets[space->nodes[k] + 1]++;
+		}
+		total += build->space_end[j] - build->space_begin[j];
+	}
+	for (u32 v = 0; v < node_count; v++) {
+		build->bucket_offsets[v + 1] += build->bucket_offsets[v];
+	}
+
+	build->buckets = (MatrixBucket *)malloc(sizeof(MatrixBucket) * (total + 1));
+	u32 *fill = (u32 *)malloc(sizeof(u32) * (node_count + 1));
+	memcpy(fill, build->bucket_offsets, sizeof(u32) * (node_count + 1));
+	for (u32 j = 0; j < build->target_count; j++) {
+		MatrixSpace *space = &build->spaces[build->space_worker[j]];
+		for (u64 k = build->space_begin[j]; k < build->space_end[j]; k++) {
+			build->buckets[fill[space->nodes[k]]++] = (MatrixBucket){ j, space->costs[k] };
+		}
+	}
+	free(fill);
+}
+
+static void matrix_forward_worker(void *arg, u32 worker, u64 begin, u64 end) {
+	MatrixBuild *build = (MatrixBuild *)arg;
+	SearchContext *ctx = build->workers[worker];
+	STAT_MARK(mark);
+
+	for (u64 i = begin; i < end; i++) {
+		f32 *row = build->times + (i * build->target_count);
+		for (u32 j = 0; j < build->target_count; j++) {
+			row[j] = INFINITY;
+		}
+
+		matrix_seed(build->g, ctx, build->sources[i]);
+		while (ctx->frontier->size > 0) {
+			u32 node = matrix_upward_step(build->ch, ctx);
+			f32 cost = ctx->cost[node];
+			for (u32 b = build->bucket_offsets[node]; b < build->bucket_offsets[node + 1]; b++) {
+				MatrixBucket *bucket = &build->buckets[b];
+				if (cost + bucket->time < row[bucket->column]) {
+					row[bucket->column] = cost + bucket->time;
+				}
+			}
+		}
+		build->settled[worker] += ctx->settled;
+		STAT_ADD(nodes_settled, ctx->settled);
+	}
+	STAT_MOVE(&build->stats[worker], mark);
+}
+
+static void matrix_dijkstra_worker(void *arg, u32 worker, u64 begin, u64 end) {
+	MatrixBuild *build = (MatrixBuild *)arg;
+	Graph *g = build->g;
+	SearchContext *ctx = build->workers[worker];
+	u32 *reached = build->reached[worker];
+	STAT_MARK(mark);
+
+	for (u64 i = begin; i < end; i++) {
+		matrix_seed(g, ctx, build->sources[i]);
+		u32 remaining = build->target_stations;
+		while (ctx->frontier->size > 0 && remaining > 0) {
+			u32 current = ih_pop(ctx->frontier, NULL);
+			ctx->settled++;
+
+			u32 station = g->node_station[current];
+			if (build->is_target[station] && reached[station] != ctx->generation) {
+				reached[station] = ctx->generation;
+				remaining--;
+			}
+			search_relax(g, ctx, current, INFINITY);
+		}
+		build->settled[worker] += ctx->settled;
+		STAT_ADD(nodes_settled, ctx->settled);
+
+		f32 *row = build->times + (i * build->target_count);
+		for (u32 j = 0; j < build->target_count; j++) {
+			u32 t = build->targets[j];
+			row[j] = INFINITY;
+			for (u32 k = g->station_offsets[t]; k < g->station_offsets[t + 1]; k++) {
+				f32 cost = search_cost(ctx, g->station_nodes[k]);
+				if (cost < row[j]) {
+					row[j] = cost;
+				}
+			}
+		}
+	}
+	STAT_MOVE(&build->stats[worker], mark);
+}
+
+/*
+ * Station ids in, flat source-major matrix out (free it with free()). The
+ * hierarchy in opts is used only while it matches the current edge times.
+ * With live updates on, every search runs against one pinned copy, which
+ * holds back writers until the matrix is done. settled, if not NULL, gets
+ * the total number of platforms settled.
+ */
+f32 *travel_matrix(Graph *g, SearchOptions *opts, u32 *sources, u32 source_count, u32 *targets, u32 target_count, u32 thread_count, u64 *settled) {
+	f32 *live_times = g->edge_times;
+	u64 version = g->version;
+	u32 slot = 0;
+	if (g->live != NULL) {
+		slot = live_pin(g->live, &live_times, &version);
+	}
+
+	MatrixBuild build;
+	memset(&build, 0, sizeof(build));
+	build.g = g;
+	build.sources = sources;
+	build.source_count = source_count;
+	build.targets = targets;
+	build.target_count = target_count;
+	build.times = (f32 *)malloc(sizeof(f32) * ((u64)source_count * target_count + 1));
+	build.workers = (SearchContext **)malloc(sizeof(SearchContext *) * thread_count);
+	build.settled = (u64 *)calloc(thread_count, sizeof(u64));
+	build.stats = (QueryStats *)calloc(thread_count, sizeof(QueryStats));
+	for (u32 i = 0; i < thread_count; i++) {
+		build.workers[i] = search_init(g->node_count);
+		build.workers[i]->times = live_times;
+		build.workers[i]->version = version;
+		build.workers[i]->pinned = true;
+	}
+	if (opts != NULL && opts->hierarchy != NULL && opts->hierarchy->version == version) {
+		build.ch = opts->hierarchy;
+	}
+
+	WorkerPool *pool = pool_init(thread_count);
+	if (build.ch != NULL) {
+		build.spaces = (MatrixSpace *)calloc(thread_count, sizeof(MatrixSpace));
+		build.space_worker = (u32 *)malloc(sizeof(u32) * (target_count + 1));
+		build.space_begin = (u64 *)malloc(sizeof(u64) * (target_count + 1));
+		build.space_end = (u64 *)malloc(sizeof(u64) * (target_count + 1));
+		pool_run(pool, matrix_backward_worker, &build, target_count, MATRIX_CHUNK);
+		matrix_fill_buckets(&build);
+		pool_run(pool, matrix_forward_worker, &build, source_count, MATRIX_CHUNK);
+
+		for (u32 i = 0; i < thread_count; i++) {
+			free(build.spaces[i].nodes);
+			free(build.spaces[i].costs);
+		}
+		free(build.spaces);
+		free(build.space_worker);
+		free(build.space_begin);
+		free(build.space_end);
+		free(build.bucket_offsets);
+		free(build.buckets);
+	} else {
+		build.is_target = (u8 *)calloc(g->station_count + 1, sizeof(u8));
+		for (u32 j = 0; j < target_count; j++) {
+			build.target_stations += !build.is_target[targets[j]];
+			build.is_target[targets[j]] = 1;
+		}
+		build.reached = (u32 **)malloc(sizeof(u32 *) * thread_count);
+		for (u32 i = 0; i < thread_count; i++) {
+			build.reached[i] = (u32 *)calloc(g->station_count + 1, sizeof(u32));
+		}
+		pool_run(pool, matrix_dijkstra_worker, &build, source_count, MATRIX_CHUNK);
+
+		for (u32 i = 0; i < thread_count; i++) {
+			free(build.reached[i]);
+		}
+		free(build.reached);
+		free(build.is_target);
+	}
+	pool_free(pool);
+	STAT_FOLD(build.stats, thread_count);
+
+	if (g->live != NULL) {
+		live_unpin(g->live, slot);
+	}
+	if (settled != NULL) {
+		*settled = 0;
+	}
+	for (u32 i = 0; i < thread_count; i++) {
+		if (settled != NULL) {
+			*settled += build.settled[i];
+		}
+		search_free(build.workers[i]);
+	}
+	free(build.workers);
+	free(build.settled);
+	free(build.stats);
+	return build.times;
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/*
+ * Fixed set of worker threads that split an index range [0, total) between
+ * them. Workers claim `chunk` indices at a time from a shared counter, so
+ * uneven query costs still balance, and pool_run blocks until the whole
+ * range is done. Each worker is told its own index so it can keep private
+ * state (scratch arenas, heaps, output buffers) without any locking.
+ */
+
+typedef void (*PoolFn)(void *ctx, u32 worker, u64 begin, u64 end);
+
+typedef struct WorkerPool {
+	pthread_t *threads;
+	u32 thread_count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+
+	PoolFn fn;
+	void *ctx;
+	u64 next;
+	u64 total;
+	u64 chunk;
+	u32 busy;
+	u64 generation;
+	bool shutdown;
+} WorkerPool;
+
+typedef struct WorkerArg {
+	WorkerPool *pool;
+	u32 worker;
+} WorkerArg;
+
+u32 cpu_count() {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (u32)count : 1;
+}
+
+static void *pool_worker(void *arg) {
+	WorkerArg *warg = (WorkerArg *)arg;
+	WorkerPool *pool = warg->pool;
+	u32 worker = warg->worker;
+	free(warg);
+
+	u64 seen_generation = 0;
+	get_lock(&pool->lock);
+	while (true) {
+		while (!pool->shutdown && pool->generation == seen_generation) {
+			wait_for_lock(&pool->work_ready, &pool->lock);
+		}
+		if (pool->shutdown) {
+			break;
+		}
+		seen_generation = pool->generation;
+		pool->busy++;
+
+		while (pool->next < pool->total) {
+			u64 begin = pool->next;
+			u64 end = begin + pool->chunk;
+			if (end > pool->total) {
+				end = pool->total;
+			}
+			pool->next = end;
+
+			release_lock(&pool->lock);
+			pool->fn(pool->ctx, worker, begin, end);
+			get_lock(&pool->lock);
+		}
+
+		pool->busy--;
+		if (pool->busy == 0) {
+			broadcast_to_locks(&pool->work_done);
+		}
+	}
+	release_lock(&pool->lock);
+	return NULL;
+}
+
+WorkerPool *pool_init(u32 thread_count) {
+	WorkerPool *pool = (WorkerPool *)calloc(1, sizeof(WorkerPool));
+	pool->thread_count = (thread_count > 0) ? thread_count : 1;
+	pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * pool->thread_count);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_ready, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+
+	for (u32 i = 0; i < pool->thread_count; i++) {
+		WorkerArg *arg = (WorkerArg *)malloc(sizeof(WorkerArg));
+		arg->pool = pool;
+		arg->worker = i;
+		pthread_create(&pool->threads[i], NULL, pool_worker, arg);
+	}
+	return pool;
+}
+
+void pool_run(WorkerPool *pool, PoolFn fn, void *ctx, u64 total, u64 chunk) {
+	get_lock(&pool->lock);
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->next = 0;
+	pool->total = total;
+	pool->chunk = (chunk > 0) ? chunk : 1;
+	pool->generation++;
+	broadcast_to_locks(&pool->work_ready);
+
+	// Done once the range is drained and no worker is still inside fn
+	while (pool->next < pool->total || pool->busy > 0) {
+		wait_for_lock(&pool->work_done, &pool->lock);
+	}
+	release_lock(&pool->lock);
+}
+
+void pool_free(WorkerPool *pool) {
+	get_lock(&pool->lock);
+	pool->shutdown = true;
+	broadcast_to_locks(&pool->work_ready);
+	release_lock(&pool->lock);
+
+	for (u32 i = 0; i < pool->thread_count; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_ready);
+	pthread_cond_destroy(&pool->work_done);
+	free(pool->threads);
+	free(pool);
+}
+
+#endif
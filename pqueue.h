@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "dynarr.h"
+#include "stats.h"
 
 #define GET_PARENT(i) (((i) - 1) / 2)
 #define GET_LEFT_CHILD(i) ((2 * (i)) + 1)
@@ -10,6 +11,7 @@
 
 typedef struct PriorityQueue {
 	DynArr *heap;
+	Arena *arena;
 } PriorityQueue;
 
 typedef struct PriorityNode {
@@ -17,15 +19,20 @@ typedef struct PriorityNode {
 	f32 priority;
 } PriorityNode;
 
-PriorityQueue *pq_init() {
-	PriorityQueue *pq = malloc(sizeof(PriorityQueue));
-	pq->heap = da_init();
+PriorityQueue *pq_arena_init(Arena *arena) {
+	PriorityQueue *pq = mem_alloc(arena, sizeof(PriorityQueue));
+	pq->heap = da_arena_init(arena, 1);
+	pq->arena = arena;
 
 	return pq;
 }
 
-PriorityNode *pnode_init(void *data, f32 priority) {
-	PriorityNode *pnode = (PriorityNode *)malloc(sizeof(PriorityNode));
+PriorityQueue *pq_init() {
+	return pq_arena_init(NULL);
+}
+
+PriorityNode *pnode_init(Arena *arena, void *data, f32 priority) {
+	PriorityNode *pnode = (PriorityNode *)mem_alloc(arena, sizeof(PriorityNode));
 	pnode->data = data;
 	pnode->priority = priority;
 	return pnode;
@@ -58,7 +65,7 @@ void sift_down_conn_heap(DynArr *heap, u64 idx) {
 		}
 	} else {
 		PriorityNode *left = heap->buffer[left_child_idx];
-		PriorityNode *right = heap->buffer[left_child_idx];
+		PriorityNode *right = heap->buffer[right_child_idx];
 		if (left->priority <= right->priority) {
 			min_idx = left_child_idx;
 		} else {
@@ -77,7 +84,8 @@ void sift_down_conn_heap(DynArr *heap, u64 idx) {
 }
 
 void pq_push(PriorityQueue *pq, void *data, f32 priority) {
-	PriorityNode *pn = pnode_init(data, priority);
+	STAT_ADD(heap_pushes, 1);
+	PriorityNode *pn = pnode_init(pq->arena, data, priority);
 	da_insert(pq->heap, pn);
 	u64 inserted_idx = pq->heap->size - 1;
 	sift_up_conn_heap(pq->heap, inserted_idx);
@@ -88,8 +96,9 @@ void *pq_pop(PriorityQueue *pq) {
 		printf("Heap is empty!\n");
 		return NULL;
 	} else {
+		STAT_ADD(heap_pops, 1);
 		void *ret = ((PriorityNode *)pq->heap->buffer[0])->data;
-		free(pq->heap->buffer[0]);
+		mem_free(pq->arena, pq->heap->buffer[0]);
 		pq->heap->buffer[0] = pq->heap->buffer[pq->heap->size - 1];
 		pq->heap->size--;
 		if (pq->heap->size > 0) {
@@ -101,7 +110,154 @@ void *pq_pop(PriorityQueue *pq) {
 
 void pq_free(PriorityQueue *pq) {
 	da_free_data(pq->heap);
-	free(pq);
+	mem_free(pq->arena, pq);
+}
+
+/*
+ * Indexed d-ary min-heap over dense ids. Entries are stored inline as
+ * (key, id) pairs and pos[] tracks where each id sits in the heap, so an
+ * id is queued at most once and an improved key is a decrease-key instead
+ * of a duplicate push. Arity must be a power of two (4 and 8 work well).
+ */
+#define IH_NOT_QUEUED ((u32)-1)
+
+typedef struct HeapEntry {
+	f32 key;
+	u32 id;
+} HeapEntry;
+
+typedef struct IndexedHeap {
+	HeapEntry *heap;
+	u32 *pos;
+	u64 size;
+	u64 capacity;
+	u32 arity_shift;
+	Arena *arena;
+} IndexedHeap;
+
+IndexedHeap *ih_arena_init(Arena *arena, u64 id_capacity, u32 arity) {
+	IndexedHeap *ih = (IndexedHeap *)mem_alloc(arena, sizeof(IndexedHeap));
+	ih->arena = arena;
+	ih->heap = (HeapEntry *)mem_alloc(arena, sizeof(HeapEntry) * (id_capacity + 1));
+	ih->pos = (u32 *)mem_alloc(arena, sizeof(u32) * (id_capacity + 1));
+	memset(ih->pos, 0xFF, sizeof(u32) * (id_capacity + 1));
+	ih->size = 0;
+	ih->capacity = id_capacity;
+
+	ih->arity_shift = 0;
+	while ((1u << ih->arity_shift) < arity) {
+		ih->arity_shift++;
+	}
+	return ih;
+}
+
+IndexedHeap *ih_init(u64 id_capacity, u32 arity) {
+	return ih_arena_init(NULL, id_capacity, arity);
+}
+
+static void ih_sift_up(IndexedHeap *ih, u64 idx) {
+	HeapEntry entry = ih->heap[idx];
+	while (idx > 0) {
+		u64 parent_idx = (idx - 1) >> ih->arity_shift;
+		HeapEntry parent = ih->heap[parent_idx];
+		if (parent.key <= entry.key) {
+			break;
+		}
+		ih->heap[idx] = parent;
+		ih->pos[parent.id] = idx;
+		idx = parent_idx;
+	}
+	ih->heap[idx] = entry;
+	ih->pos[entry.id] = idx;
+}
+
+static void ih_sift_down(IndexedHeap *ih, u64 idx) {
+	HeapEntry entry = ih->heap[idx];
+	while (true) {
+		u64 first_child = (idx << ih->arity_shift) + 1;
+		if (first_child >= ih->size) {
+			break;
+		}
+
+		u64 last_child = first_child + (1u << ih->arity_shift);
+		if (last_child > ih->size) {
+			last_child = ih->size;
+		}
+
+		u64 min_idx = first_child;
+		f32 min_key = ih->heap[first_child].key;
+		for (u64 c = first_child + 1; c < last_child; c++) {
+			if (ih->heap[c].key < min_key) {
+				min_key = ih->heap[c].key;
+				min_idx = c;
+			}
+		}
+
+		if (entry.key <= min_key) {
+			break;
+		}
+		ih->heap[idx] = ih->heap[min_idx];
+		ih->pos[ih->heap[idx].id] = idx;
+		idx = min_idx;
+	}
+	ih->heap[idx] = entry;
+	ih->pos[entry.id] = idx;
+}
+
+bool ih_contains(IndexedHeap *ih, u32 id) {
+	return ih->pos[id] != IH_NOT_QUEUED;
+}
+
+// Inserts id, or lowers its key if it is already queued with a larger one
+void ih_push(IndexedHeap *ih, u32 id, f32 key) {
+	STAT_ADD(heap_pushes, 1);
+	u32 idx = ih->pos[id];
+	if (idx == IH_NOT_QUEUED) {
+		idx = ih->size;
+		ih->size++;
+	} else {
+		STAT_ADD(heap_duplicates, 1);
+		if (ih->heap[idx].key <= key) {
+			return;
+		}
+	}
+
+	ih->heap[idx] = (HeapEntry){ key, id };
+	ih_sift_up(ih, idx);
+}
+
+u32 ih_pop(IndexedHeap *ih, f32 *key) {
+	if (ih->size == 0) {
+		printf("Heap is empty!\n");
+		return IH_NOT_QUEUED;
+	}
+
+	STAT_ADD(heap_pops, 1);
+	HeapEntry top = ih->heap[0];
+	ih->pos[top.id] = IH_NOT_QUEUED;
+	ih->size--;
+	if (ih->size > 0) {
+		ih->heap[0] = ih->heap[ih->size];
+		ih_sift_down(ih, 0);
+	}
+
+	if (key) {
+		*key = top.key;
+	}
+	return top.id;
+}
+
+void ih_clear(IndexedHeap *ih) {
+	for (u64 i = 0; i < ih->size; i++) {
+		ih->pos[ih->heap[i].id] = IH_NOT_QUEUED;
+	}
+	ih->size = 0;
+}
+
+void ih_free(IndexedHeap *ih) {
+	mem_free(ih->arena, ih->heap);
+	mem_free(ih->arena, ih->pos);
+	mem_free(ih->arena, ih);
 }
 
 #endif
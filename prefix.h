@@ -0,0 +1,161 @@
+#ifndef PREFIX_H
+#define PREFIX_H
+
+#include "common.h"
+#include "graph.h"
+
+/*
+ * Type-ahead over station names. Every name is folded to ASCII lower case
+ * and the folded names are sorted, so the names starting with a prefix are
+ * one contiguous run found by binary search. The station ids, the offsets
+ * of their folded names and the names themselves all sit in one allocation
+ * after the header, in sorted order, so a scan walks memory forwards.
+ *
+ * The whole run is ranked, not just its first entries: an exact match
+ * comes first, then stations served by more lines, then alphabetical
+ * order. A one letter prefix over tens of thousands of stations still
+ * scans only a few thousand short strings.
+ */
+
+#define PREFIX_MAX_LIMIT 100
+
+typedef struct PrefixIndex {
+	u32 count;
+	// station ids in folded name order
+	u32 *stations;
+	// folded name of stations[i] at names + name_off[i], NUL terminated
+	u32 *name_off;
+	char *names;
+} PrefixIndex;
+
+typedef struct PrefixEntry {
+	char *name;
+	u32 station;
+} PrefixEntry;
+
+static inline char prefix_fold(char c) {
+	return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+}
+
+static int prefix_compare_entries(const void *a, const void *b) {
+	return strcmp(((const PrefixEntry *)a)->name, ((const PrefixEntry *)b)->name);
+}
+
+PrefixIndex *prefix_build(Graph *g) {
+	u32 count = g->station_count;
+	u64 name_bytes = 0;
+	for (u32 s = 0; s < count; s++) {
+		name_bytes += strlen(station_name(g, s)) + 1;
+	}
+
+	u64 header = sizeof(PrefixIndex) + (sizeof(u32) * 2 * ((u64)count + 1));
+	PrefixIndex *ix = (PrefixIndex *)malloc(header + name_bytes + 1);
+	ix->count = count;
+	ix->stations = (u32 *)(ix + 1);
+	ix->name_off = ix->stations + count + 1;
+	ix->names = (char *)ix + header;
+
+	// Fold in station order first, then sort pointers into that copy
+	char *folded = (char *)malloc(name_bytes + 1);
+	PrefixEntry *entries = (PrefixEntry *)malloc(sizeof(PrefixEntry) * ((u64)count + 1));
+	u64 off = 0;
+	for (u32 s = 0; s < count; s++) {
+		entries[s].name = folded + off;
+		entries[s].station = s;
+		for (char *c = station_name(g, s); *c; c++) {
+			folded[off++] = prefix_fold(*c);
+		}
+		folded[off++] = 0;
+	}
+	qsort(entries, count, sizeof(PrefixEntry), prefix_compare_entries);
+
+	off = 0;
+	for (u32 i = 0; i < count; i++) {
+		u64 len = strlen(entries[i].name) + 1;
+		ix->stations[i] = entries[i].station;
+		ix->name_off[i] = (u32)off;
+		memcpy(ix->names + off, entries[i].name, len);
+		off += len;
+	}
+
+	free(entries);
+	free(folded);
+	return ix;
+}
+
+void prefix_free(PrefixIndex *ix) {
+	free(ix);
+}
+
+// true when a should be listed before b
+static bool prefix_ranks_before(PrefixIndex *ix, Graph *g, u32 a, u32 b, u64 len) {
+	bool exact_a = ix->names[ix->name_off[a] + len] == 0;
+	bool exact_b = ix->names[ix->name_off[b] + len] == 0;
+	if (exact_a != exact_b) {
+		return exact_a;
+	}
+	u32 sa = ix->stations[a];
+	u32 sb = ix->stations[b];
+	u32 lines_a = g->station_offsets[sa + 1] - g->station_offsets[sa];
+	u32 lines_b = g->station_offsets[sb + 1] - g->station_offsets[sb];
+	if (lines_a != lines_b) {
+		return lines_a > lines_b;
+	}
+	// the run is already alphabetical
+	return a < b;
+}
+
+/*
+ * Writes up to limit station ids whose names start with prefix, ignoring
+ * ASCII case, best first, and returns how many were written. limit is
+ * capped at PREFIX_MAX_LIMIT.
+ */
+u32 prefix_complete(PrefixIndex *ix, Graph *g, char *prefix, u64 len, u32 *stations, u32 limit) {
+	char key[MAX_NAME_LEN + 1];
+	if (len > MAX_NAME_LEN) {
+		return 0;
+	}
+	for (u64 i = 0; i < len; i++) {
+		key[i] = prefix_fold(prefix[i]);
+	}
+	if (limit > PREFIX_MAX_LIMIT) {
+		limit = PREFIX_MAX_LIMIT;
+	}
+	if (limit == 0) {
+		return 0;
+	}
+
+	// First name not below the prefix
+	u32 lo = 0;
+	u32 hi = ix->count;
+	while (lo < hi) {
+		u32 mid = lo + (hi - lo) / 2;
+		if (strncmp(ix->names + ix->name_off[mid], key, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	// Keep the best limit positions of the run, sorted, by insertion
+	u32 best[PREFIX_MAX_LIMIT];
+	u32 found = 0;
+	for (u32 i = lo; i < ix->count && !strncmp(ix->names + ix->name_off[i], key, len); i++) {
+		if (found == limit && !prefix_ranks_before(ix, g, i, best[found - 1], len)) {
+			continue;
+		}
+		u32 at = (found < limit) ? found++ : found - 1;
+		while (at > 0 && prefix_ranks_before(ix, g, i, best[at - 1], len)) {
+			best[at] = best[at - 1];
+			at--;
+		}
+		best[at] = i;
+	}
+
+	for (u32 i = 0; i < found; i++) {
+		stations[i] = ix->stations[best[i]];
+	}
+	return found;
+}
+
+#endif
@@ -0,0 +1,928 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <math.h>
+
+#include "common.h"
+#include "pqueue.h"
+#include "graph.h"
+#include "arena.h"
+#include "cache.h"
+#include "live.h"
+#include "delta.h"
+
+#define HEAP_ARITY 4
+
+typedef struct Route {
+	u32 *path;
+	u64 path_size;
+	f32 accum_time;
+	char *start;
+	u32 start_node;
+	char *end;
+	u32 end_node;
+	Arena *arena;
+} Route;
+
+Route *new_route(Arena *arena, f32 accum_time, char *start, u32 start_node, char *end, u32 end_node) {
+	Route *route = (Route *)mem_alloc(arena, sizeof(Route));
+	route->arena = arena;
+	route->path = NULL;
+	route->path_size = 0;
+	route->accum_time = accum_time;
+	route->start = start;
+	route->start_node = start_node;
+	route->end = end;
+	route->end_node = end_node;
+	return route;
+}
+
+void free_route(Route *route) {
+	if (route->path != NULL) {
+		mem_free(route->arena, route->path);
+	}
+	mem_free(route->arena, route);
+}
+
+typedef enum SearchMode {
+	SEARCH_DIJKSTRA,
+	SEARCH_ALT,
+	SEARCH_CH,
+	SEARCH_BIDIRECTIONAL,
+	SEARCH_TABLE,
+	SEARCH_DELTA,
+} SearchMode;
+
+/*
+ * Exact travel times between a few landmark platforms and every platform,
+ * stored node-major (dist[node * count + l]) so one heuristic evaluation
+ * reads one contiguous row. The graph is symmetric, so these are distances
+ * both to and from each landmark. Built by landmarks.h.
+ */
+typedef struct Landmarks {
+	// edge times version the distances were measured on
+	u64 version;
+	u32 count;
+	u32 node_count;
+	u32 *nodes;
+	f32 *dist;
+} Landmarks;
+
+/*
+ * Contraction hierarchy over the platform graph (built by hierarchy.h).
+ * Because the graph is symmetric one upward graph serves both query
+ * directions: every edge, original or shortcut, is stored once under its
+ * lower ranked endpoint. Shortcuts name the two lower edges they replace in
+ * up_children (NO_NODE for original edges), and both of those start at the
+ * contracted middle platform.
+ */
+typedef struct Hierarchy {
+	u64 version;
+	u32 node_count;
+	u32 edge_count;
+	u32 shortcut_count;
+	u32 *up_offsets;
+	u32 *up_targets;
+	f32 *up_weights;
+	u32 *up_sources;
+	u32 *up_children;
+	// set when the arrays point into a mapped file
+	File *file;
+} Hierarchy;
+
+/*
+ * Precomputed answers for every station pair (built by table.h), indexed
+ * destination-major: times[t * S + s] is the trip time from station s to
+ * station t and entry[t * S + s] the platform of s it starts from. hops[t *
+ * N + v] is the next platform after v on a shortest path to t, NO_NODE on
+ * t's own platforms, so a path is walked forward without any search.
+ */
+typedef struct RouteTable {
+	u64 version;
+	u32 station_count;
+	u32 node_count;
+	f32 *times;
+	u32 *entry;
+	u32 *hops;
+	// set when the arrays point into a mapped file
+	File *file;
+} RouteTable;
+
+/*
+ * Search state kept across queries. cost/from are dense per node but only
+ * valid where stamp matches the current generation, so starting a query is
+ * a generation bump plus clearing whatever the last query left in the heap,
+ * never a pass over every node. Routes are built in the context's arena and
+ * stay valid until the next query on the same context. Once the arena's
+ * blocks have grown to fit, a query does no mallocs at all.
+ */
+typedef struct SearchContext {
+	u32 node_capacity;
+	u32 generation;
+	u32 *stamp;
+	f32 *cost;
+	u32 *from;
+	IndexedHeap *frontier;
+	Arena *arena;
+
+	SearchMode mode;
+	Landmarks *landmarks;
+	Hierarchy *hierarchy;
+	RouteTable *table;
+	// finished routes by station pair, NULL when caching is off
+	RouteCache *cache;
+	// backward search state for bidirectional modes, made on first use
+	struct SearchContext *reverse;
+	// edge times the current query runs on and their version; pinned
+	// queries hold one live copy, otherwise these are the loaded times
+	f32 *times;
+	u64 version;
+	bool pinned;
+	// parallel search state for SEARCH_DELTA, made on first use
+	DeltaStepping *delta;
+	f32 delta_width;
+	u32 delta_threads;
+	// nodes popped from the frontier by the last query
+	u64 settled;
+} SearchContext;
+
+SearchContext *search_init(u32 node_count) {
+	SearchContext *ctx = (SearchContext *)malloc(sizeof(SearchContext));
+	ctx->node_capacity = node_count;
+	ctx->generation = 0;
+	ctx->stamp = (u32 *)calloc(node_count + 1, sizeof(u32));
+	ctx->cost = (f32 *)malloc(sizeof(f32) * (node_count + 1));
+	ctx->from = (u32 *)malloc(sizeof(u32) * (node_count + 1));
+	ctx->frontier = ih_init(node_count, HEAP_ARITY);
+	ctx->arena = arena_sized_init(64 * 1024);
+	ctx->mode = SEARCH_DIJKSTRA;
+	ctx->landmarks = NULL;
+	ctx->hierarchy = NULL;
+	ctx->table = NULL;
+	ctx->cache = NULL;
+	ctx->reverse = NULL;
+	ctx->times = NULL;
+	ctx->version = 0;
+	ctx->pinned = false;
+	ctx->delta = NULL;
+	ctx->delta_width = 0;
+	ctx->delta_threads = 1;
+	ctx->settled = 0;
+	return ctx;
+}
+
+// How a context routes; shared by every worker of a server or batch
+typedef struct SearchOptions {
+	SearchMode mode;
+	Landmarks *landmarks;
+	Hierarchy *hierarchy;
+	RouteTable *table;
+	// per context route cache budget in bytes, 0 for none
+	u64 cache_bytes;
+	// scheduled routing for queries with a departure time (timetable.h)
+	struct Timetable *timetable;
+	// station name completion for the server (prefix.h)
+	struct PrefixIndex *names;
+	// delta-stepping bucket width in minutes (0 for the mean edge time) and threads per context
+	f32 delta_width;
+	u32 delta_threads;
+} SearchOptions;
+
+void search_configure(SearchContext *ctx, SearchOptions *opts) {
+	if (opts == NULL) {
+		return;
+	}
+	ctx->mode = opts->mode;
+	ctx->landmarks = opts->landmarks;
+	ctx->hierarchy = opts->hierarchy;
+	ctx->table = opts->table;
+	ctx->delta_width = opts->delta_width;
+	ctx->delta_threads = opts->delta_threads;
+	if (ctx->delta != NULL) {
+		delta_free(ctx->delta);
+		ctx->delta = NULL;
+	}
+	if (ctx->cache != NULL) {
+		cache_free(ctx->cache);
+		ctx->cache = NULL;
+	}
+	if (opts->cache_bytes > 0) {
+		ctx->cache = cache_init(opts->cache_bytes);
+	}
+}
+
+void search_free(SearchContext *ctx) {
+	free(ctx->stamp);
+	free(ctx->cost);
+	free(ctx->from);
+	ih_free(ctx->frontier);
+	arena_free(ctx->arena);
+	if (ctx->reverse != NULL) {
+		search_free(ctx->reverse);
+	}
+	if (ctx->cache != NULL) {
+		cache_free(ctx->cache);
+	}
+	if (ctx->delta != NULL) {
+		delta_free(ctx->delta);
+	}
+	free(ctx);
+}
+
+void search_begin(SearchContext *ctx, Graph *g) {
+	if (g->node_count > ctx->node_capacity) {
+		debug("[SEARCH] growing context from %u to %u nodes\n", ctx->node_capacity, g->node_count);
+		ctx->node_capacity = g->node_count;
+		ctx->stamp = (u32 *)realloc(ctx->stamp, sizeof(u32) * (g->node_count + 1));
+		ctx->cost = (f32 *)realloc(ctx->cost, sizeof(f32) * (g->node_count + 1));
+		ctx->from = (u32 *)realloc(ctx->from, sizeof(u32) * (g->node_count + 1));
+		ih_free(ctx->frontier);
+		ctx->frontier = ih_init(g->node_count, HEAP_ARITY);
+		memset(ctx->stamp, 0, sizeof(u32) * (ctx->node_capacity + 1));
+		ctx->generation = 0;
+	}
+
+	// Only a wrapped generation forces a full clear of the stamps
+	ctx->generation++;
+	if (ctx->generation == 0) {
+		memset(ctx->stamp, 0, sizeof(u32) * (ctx->node_capacity + 1));
+		ctx->generation = 1;
+	}
+
+	ih_clear(ctx->frontier);
+	arena_reset(ctx->arena);
+	ctx->settled = 0;
+	if (!ctx->pinned) {
+		ctx->times = g->edge_times;
+		ctx->version = g->version;
+	}
+}
+
+// Starts the backward half of a bidirectional query
+SearchContext *search_reverse(SearchContext *ctx, Graph *g) {
+	if (ctx->reverse == NULL) {
+		ctx->reverse = search_init(g->node_count);
+	}
+	search_begin(ctx->reverse, g);
+	ctx->reverse->times = ctx->times;
+	return ctx->reverse;
+}
+
+static inline f32 search_cost(SearchContext *ctx, u32 node) {
+	return (ctx->stamp[node] == ctx->generation) ? ctx->cost[node] : INFINITY;
+}
+
+static inline void search_set(SearchContext *ctx, u32 node, f32 cost, u32 from) {
+	ctx->stamp[node] = ctx->generation;
+	ctx->cost[node] = cost;
+	ctx->from[node] = from;
+}
+
+void fill_route_path(SearchContext *ctx, Route *route) {
+	if (route->accum_time == INFINITY) {
+		return;
+	}
+	STAT_CLOCK(start);
+
+	u64 path_size = 1;
+	for (u32 current = route->end_node; ctx->from[current] != NO_NODE; current = ctx->from[current]) {
+		path_size++;
+	}
+
+	u32 *path = (u32 *)mem_alloc(route->arena, sizeof(u32) * path_size);
+	u32 current = route->end_node;
+	for (u64 i = path_size; i > 0; i--) {
+		path[i - 1] = current;
+		current = ctx->from[current];
+	}
+	route->path = path;
+	route->path_size = path_size;
+	route->start_node = path[0];
+	STAT_PHASE(path_cycles, start);
+}
+
+static void search_seed(SearchContext *ctx, u32 *start_nodes, u32 start_count) {
+	for (u32 i = 0; i < start_count; i++) {
+		ih_push(ctx->frontier, start_nodes[i], 0);
+		search_set(ctx, start_nodes[i], 0.0f, NO_NODE);
+	}
+}
+
+static Route *search_finish(SearchContext *ctx, char *start, char *end, u32 end_node) {
+	f32 accum_time = (end_node == NO_NODE) ? INFINITY : ctx->cost[end_node];
+	Route *route = new_route(ctx->arena, accum_time, start, NO_NODE, end, end_node);
+	fill_route_path(ctx, route);
+	return route;
+}
+
+// Relaxes current's edges, leaving out anything that would cost more than limit
+static inline void search_relax(Graph *g, SearchContext *ctx, u32 current, f32 limit) {
+	f32 current_cost = ctx->cost[current];
+	for (u32 e = g->edge_offsets[current]; e < g->edge_offsets[current + 1]; e++) {
+		u32 next = g->edge_targets[e];
+		f32 new_cost = current_cost + ctx->times[e];
+		STAT_ADD(edges_relaxed, 1);
+
+		if (new_cost <= limit && new_cost < search_cost(ctx, next)) {
+			search_set(ctx, next, new_cost, current);
+			ih_push(ctx->frontier, next, new_cost);
+		}
+	}
+}
+
+/*
+ * Plain Dijkstra from every platform in start_nodes at cost 0. It stops as
+ * soon as it settles a platform of end_station, or runs to exhaustion when
+ * end_station is NO_NODE. Returns the settled end platform, if any; costs
+ * and predecessors are left in ctx.
+ */
+u32 search_dijkstra(Graph *g, SearchContext *ctx, u32 *start_nodes, u32 start_count, u32 end_station) {
+	search_begin(ctx, g);
+	search_seed(ctx, start_nodes, start_count);
+	IndexedHeap *frontier = ctx->frontier;
+
+	while (frontier->size > 0) {
+		u32 current = ih_pop(frontier, NULL);
+		ctx->settled++;
+
+		if (g->node_station[current] == end_station) {
+			return current;
+		}
+		search_relax(g, ctx, current, INFINITY);
+	}
+
+	return NO_NODE;
+}
+
+/*
+ * Every platform in start_nodes is seeded at cost 0, and the search stops as
+ * soon as it settles any platform of end_station, so a single run covers all
+ * (start line, end line) pairs.
+ */
+Route *find_route(Graph *g, SearchContext *ctx, char *start, u32 *start_nodes, u32 start_count, char *end, u32 end_station) {
+	u32 end_node = search_dijkstra(g, ctx, start_nodes, start_count, end_station);
+	return search_finish(ctx, start, end, end_node);
+}
+
+typedef void (*IsochroneFn)(void *arg, u32 node, f32 time);
+
+/*
+ * One search from start, cut off at budget minutes instead of at a target.
+ * Each reachable station is handed to fn once, as soon as its first platform
+ * settles, so callers can stream results while the search is still running;
+ * the platform passed says which line reaches it soonest. Stations come out
+ * in order of travel time. Returns the number reported, or NO_NODE for an
+ * unknown station.
+ */
+u32 find_isochrone(Graph *g, SearchContext *ctx, char *start, f32 budget, IsochroneFn fn, void *arg) {
+	u32 start_station = graph_find_station(g, start);
+	if (start_station == NO_NODE) {
+		return NO_NODE;
+	}
+
+	u32 slot = 0;
+	if (g->live != NULL) {
+		slot = live_pin(g->live, &ctx->times, &ctx->version);
+		ctx->pinned = true;
+	}
+	search_begin(ctx, g);
+	search_seed(ctx, g->station_nodes + g->station_offsets[start_station], g->station_offsets[start_station + 1] - g->station_offsets[start_station]);
+
+	u8 *reported = (u8 *)mem_alloc(ctx->arena, g->station_count);
+	memset(reported, 0, g->station_count);
+	u32 count = 0;
+	while (ctx->frontier->size > 0) {
+		u32 current = ih_pop(ctx->frontier, NULL);
+		ctx->settled++;
+
+		u32 station = g->node_station[current];
+		if (!reported[station]) {
+			reported[station] = 1;
+			count++;
+			fn(arg, current, ctx->cost[current]);
+		}
+		search_relax(g, ctx, current, budget);
+	}
+
+	if (ctx->pinned) {
+		ctx->pinned = false;
+		live_unpin(g->live, slot);
+	}
+	return count;
+}
+
+// Settles one platform of one half of a bidirectional Dijkstra
+static void bidirectional_step(Graph *g, SearchContext *ctx, SearchContext *other, f32 *best, u32 *meet) {
+	u32 current = ih_pop(ctx->frontier, NULL);
+	ctx->settled++;
+
+	f32 current_cost = ctx->cost[current];
+	for (u32 e = g->edge_offsets[current]; e < g->edge_offsets[current + 1]; e++) {
+		u32 next = g->edge_targets[e];
+		f32 new_cost = current_cost + ctx->times[e];
+		STAT_ADD(edges_relaxed, 1);
+
+		if (new_cost < search_cost(ctx, next)) {
+			search_set(ctx, next, new_cost, current);
+			ih_push(ctx->frontier, next, new_cost);
+
+			f32 through = new_cost + search_cost(other, next);
+			if (through < *best) {
+				*best = through;
+				*meet = next;
+			}
+		}
+	}
+}
+
+/*
+ * Dijkstra from the start and end platforms at once. The graph is
+ * symmetric, so the backward half walks the same adjacency. It stops once
+ * the two frontier minimums add up to at least the best meeting point, at
+ * which point no undiscovered path can be shorter.
+ */
+Route *find_route_bidirectional(Graph *g, SearchContext *ctx, char *start, u32 *start_nodes, u32 start_count, char *end, u32 end_station) {
+	search_begin(ctx, g);
+	SearchContext *back = search_reverse(ctx, g);
+	u32 *end_nodes = g->station_nodes + g->station_offsets[end_station];
+	u32 end_count = g->station_offsets[end_station + 1] - g->station_offsets[end_station];
+	search_seed(ctx, start_nodes, start_count);
+	search_seed(back, end_nodes, end_count);
+
+	f32 best = INFINITY;
+	u32 meet = NO_NODE;
+	for (u32 i = 0; i < start_count; i++) {
+		if (g->node_station[start_nodes[i]] == end_station) {
+			best = 0;
+			meet = start_nodes[i];
+		}
+	}
+
+	IndexedHeap *forward = ctx->frontier;
+	IndexedHeap *backward = back->frontier;
+	while (forward->size > 0 && backward->size > 0 && forward->heap[0].key + backward->heap[0].key < best) {
+		if (forward->size <= backward->size) {
+			bidirectional_step(g, ctx, back, &best, &meet);
+		} else {
+			bidirectional_step(g, back, ctx, &best, &meet);
+		}
+	}
+	ctx->settled += back->settled;
+
+	Route *route = new_route(ctx->arena, best, start, NO_NODE, end, NO_NODE);
+	if (meet == NO_NODE) {
+		return route;
+	}
+
+	u64 forward_size = 0;
+	u64 path_size = 1;
+	for (u32 node = meet; ctx->from[node] != NO_NODE; node = ctx->from[node]) {
+		forward_size++;
+	}
+	for (u32 node = meet; back->from[node] != NO_NODE; node = back->from[node]) {
+		path_size++;
+	}
+	path_size += forward_size;
+
+	u32 *path = (u32 *)mem_alloc(route->arena, sizeof(u32) * path_size);
+	u64 at = forward_size;
+	for (u32 node = meet; node != NO_NODE; node = ctx->from[node]) {
+		path[at--] = node;
+	}
+	at = forward_size + 1;
+	for (u32 node = back->from[meet]; node != NO_NODE; node = back->from[node]) {
+		path[at++] = node;
+	}
+
+	route->path = path;
+	route->path_size = path_size;
+	route->start_node = path[0];
+	route->end_node = path[path_size - 1];
+	return route;
+}
+
+/*
+ * Lower bound from node to the nearest target through each landmark l:
+ * |d(l, t) - d(l, node)| >= the gap to the interval [min_t d(l, t),
+ * max_t d(l, t)] over the target platforms. Taking the max over landmarks
+ * keeps it consistent. Landmarks in another component are skipped.
+ */
+static inline f32 landmark_bound(Landmarks *lm, u32 node, f32 *target_min, f32 *target_max) {
+	f32 *row = lm->dist + ((u64)node * lm->count);
+	f32 bound = 0;
+	for (u32 l = 0; l < lm->count; l++) {
+		f32 d = row[l];
+		if (d == INFINITY || target_max[l] == INFINITY) {
+			continue;
+		}
+		f32 below = target_min[l] - d;
+		f32 above = d - target_max[l];
+		if (below > bound) {
+			bound = below;
+		}
+		if (above > bound) {
+			bound = above;
+		}
+	}
+	return bound;
+}
+
+// A* over the same graph, using landmark (ALT) lower bounds as the heuristic
+Route *find_route_alt(Graph *g, SearchContext *ctx, char *start, u32 *start_nodes, u32 start_count, char *end, u32 end_station) {
+	Landmarks *lm = ctx->landmarks;
+	search_begin(ctx, g);
+
+	f32 *target_min = (f32 *)mem_alloc(ctx->arena, sizeof(f32) * lm->count * 2);
+	f32 *target_max = target_min + lm->count;
+	for (u32 l = 0; l < lm->count; l++) {
+		target_min[l] = INFINITY;
+		target_max[l] = 0;
+		for (u32 i = g->station_offsets[end_station]; i < g->station_offsets[end_station + 1]; i++) {
+			f32 d = lm->dist[((u64)g->station_nodes[i] * lm->count) + l];
+			if (d < target_min[l]) {
+				target_min[l] = d;
+			}
+			if (d > target_max[l]) {
+				target_max[l] = d;
+			}
+		}
+	}
+
+	IndexedHeap *frontier = ctx->frontier;
+	for (u32 i = 0; i < start_count; i++) {
+		search_set(ctx, start_nodes[i], 0.0f, NO_NODE);
+		ih_push(frontier, start_nodes[i], landmark_bound(lm, start_nodes[i], target_min, target_max));
+	}
+
+	u32 end_node = NO_NODE;
+	while (frontier->size > 0) {
+		u32 current = ih_pop(frontier, NULL);
+		ctx->settled++;
+
+		if (g->node_station[current] == end_station) {
+			end_node = current;
+			break;
+		}
+
+		f32 current_cost = ctx->cost[current];
+		for (u32 e = g->edge_offsets[current]; e < g->edge_offsets[current + 1]; e++) {
+			u32 next = g->edge_targets[e];
+			f32 new_cost = current_cost + ctx->times[e];
+			STAT_ADD(edges_relaxed, 1);
+
+			if (new_cost < search_cost(ctx, next)) {
+				f32 h = landmark_bound(lm, next, target_min, target_max);
+				search_set(ctx, next, new_cost, current);
+				ih_push(frontier, next, new_cost + h);
+			}
+		}
+	}
+
+	return search_finish(ctx, start, end, end_node);
+}
+
+// Appends the platforms along edge e walked away from `from`, excluding `from`
+static u64 hierarchy_unpack(Hierarchy *ch, u32 e, u32 from, u32 *out) {
+	u32 source = ch->up_sources[e];
+	u32 target = ch->up_targets[e];
+	u32 *children = ch->up_children + ((u64)e * 2);
+	if (children[0] == NO_NODE) {
+		out[0] = (from == source) ? target : source;
+		return 1;
+	}
+
+	u32 middle = ch->up_sources[children[0]];
+	if (from == source) {
+		u64 n = hierarchy_unpack(ch, children[0], from, out);
+		return n + hierarchy_unpack(ch, children[1], middle, out + n);
+	}
+	u64 n = hierarchy_unpack(ch, children[1], from, out);
+	return n + hierarchy_unpack(ch, children[0], middle, out + n);
+}
+
+static u64 hierarchy_length(Hierarchy *ch, u32 e) {
+	u32 *children = ch->up_children + ((u64)e * 2);
+	if (children[0] == NO_NODE) {
+		return 1;
+	}
+	return hierarchy_length(ch, children[0]) + hierarchy_length(ch, children[1]);
+}
+
+/*
+ * Settles the cheapest frontier entry of one half of a hierarchy query,
+ * relaxing upward edges only, and updates the best meeting point. In both
+ * halves `from` holds the edge a platform was reached by, not a platform.
+ */
+static void hierarchy_step(Hierarchy *ch, SearchContext *ctx, SearchContext *other, f32 *best, u32 *meet) {
+	u32 current = ih_pop(ctx->frontier, NULL);
+	ctx->settled++;
+
+	f32 current_cost = ctx->cost[current];
+	f32 through = current_cost + search_cost(other, current);
+	if (through < *best) {
+		*best = through;
+		*meet = current;
+	}
+
+	for (u32 e = ch->up_offsets[current]; e < ch->up_offsets[current + 1]; e++) {
+		u32 next = ch->up_targets[e];
+		f32 new_cost = current_cost + ch->up_weights[e];
+		STAT_ADD(edges_relaxed, 1);
+		if (new_cost < search_cost(ctx, next)) {
+			search_set(ctx, next, new_cost, e);
+			ih_push(ctx->frontier, next, new_cost);
+		}
+	}
+}
+
+/*
+ * Bidirectional upward search over the hierarchy. Each half stops once its
+ * cheapest frontier entry costs at least the best meeting point found, and
+ * the shortcuts on both halves are unpacked into the full platform path.
+ */
+Route *find_route_ch(Graph *g, SearchContext *ctx, char *start, u32 *start_nodes, u32 start_count, char *end, u32 end_station) {
+	Hierarchy *ch = ctx->hierarchy;
+	search_begin(ctx, g);
+	SearchContext *back = search_reverse(ctx, g);
+
+	search_seed(ctx, start_nodes, start_count);
+	for (u32 i = g->station_offsets[end_station]; i < g->station_offsets[end_station + 1]; i++) {
+		ih_push(back->frontier, g->station_nodes[i], 0);
+		search_set(back, g->station_nodes[i], 0.0f, NO_NODE);
+	}
+
+	f32 best = INFINITY;
+	u32 meet = NO_NODE;
+	IndexedHeap *forward = ctx->frontier;
+	IndexedHeap *backward = back->frontier;
+	while (true) {
+		bool forward_live = forward->size > 0 && forward->heap[0].key < best;
+		bool backward_live = backward->size > 0 && backward->heap[0].key < best;
+		if (forward_live && (!backward_live || forward->heap[0].key <= backward->heap[0].key)) {
+			hierarchy_step(ch, ctx, back, &best, &meet);
+		} else if (backward_live) {
+			hierarchy_step(ch, back, ctx, &best, &meet);
+		} else {
+			break;
+		}
+	}
+	ctx->settled += back->settled;
+
+	Route *route = new_route(ctx->arena, best, start, NO_NODE, end, NO_NODE);
+	if (meet == NO_NODE) {
+		return route;
+	}
+
+	// Count first so the path is one exact allocation, meet at forward_size
+	STAT_CLOCK(unpack);
+	u64 forward_size = 0;
+	u64 path_size = 1;
+	u32 node = meet;
+	while (ctx->from[node] != NO_NODE) {
+		forward_size += hierarchy_length(ch, ctx->from[node]);
+		node = ch->up_sources[ctx->from[node]];
+	}
+	for (node = meet; back->from[node] != NO_NODE; node = ch->up_sources[back->from[node]]) {
+		path_size += hierarchy_length(ch, back->from[node]);
+	}
+	path_size += forward_size;
+
+	u32 *path = (u32 *)mem_alloc(route->arena, sizeof(u32) * path_size);
+	u64 at = forward_size + 1;
+	for (node = meet; ctx->from[node] != NO_NODE; node = ch->up_sources[ctx->from[node]]) {
+		u32 e = ctx->from[node];
+		at -= hierarchy_length(ch, e);
+		hierarchy_unpack(ch, e, ch->up_sources[e], path + at);
+	}
+	path[0] = node;
+
+	at = forward_size + 1;
+	for (node = meet; back->from[node] != NO_NODE; node = ch->up_sources[back->from[node]]) {
+		at += hierarchy_unpack(ch, back->from[node], node, path + at);
+	}
+
+	route->path = path;
+	route->path_size = path_size;
+	route->start_node = path[0];
+	route->end_node = path[path_size - 1];
+	STAT_PHASE(path_cycles, unpack);
+	return route;
+}
+
+// Two table reads for the time, then one per platform on the path
+Route *find_route_table(Graph *g, SearchContext *ctx, char *start, u32 start_station, char *end, u32 end_station) {
+	RouteTable *table = ctx->table;
+	search_begin(ctx, g);
+
+	u64 cell = ((u64)end_station * table->station_count) + start_station;
+	Route *route = new_route(ctx->arena, table->times[cell], start, NO_NODE, end, NO_NODE);
+	if (route->accum_time == INFINITY) {
+		return route;
+	}
+
+	STAT_CLOCK(walk);
+	u32 *hops = table->hops + ((u64)end_station * table->node_count);
+	u64 path_size = 1;
+	for (u32 node = table->entry[cell]; hops[node] != NO_NODE; node = hops[node]) {
+		path_size++;
+	}
+
+	u32 *path = (u32 *)mem_alloc(route->arena, sizeof(u32) * path_size);
+	u32 node = table->entry[cell];
+	for (u64 i = 0; i < path_size; i++) {
+		path[i] = node;
+		node = hops[node];
+	}
+
+	route->path = path;
+	route->path_size = path_size;
+	route->start_node = path[0];
+	route->end_node = path[path_size - 1];
+	STAT_PHASE(path_cycles, walk);
+	return route;
+}
+
+/*
+ * Point-to-point delta-stepping (delta.h). The result is copied into ctx's
+ * cost and predecessor arrays for the end platform's path only, so the
+ * route is built the same way as every other mode's.
+ */
+Route *find_route_delta(Graph *g, SearchContext *ctx, char *start, u32 *start_nodes, u32 start_count, char *end, u32 end_station) {
+	if (ctx->delta == NULL) {
+		ctx->delta = delta_init(g->node_count, ctx->delta_width, ctx->delta_threads);
+	}
+	search_begin(ctx, g);
+	DeltaStepping *ds = ctx->delta;
+	u32 end_node = delta_run(ds, g, ctx->times, start_nodes, start_count, end_station);
+	ctx->settled = ds->settled;
+
+	for (u32 node = end_node; node != NO_NODE; node = delta_from(ds, node)) {
+		search_set(ctx, node, delta_cost(ds, node), delta_from(ds, node));
+	}
+	return search_finish(ctx, start, end, end_node);
+}
+
+// Precomputed modes only apply while the edge times match what they were built on
+static Route *route_stations(Graph *g, SearchContext *ctx, char *start, u32 start_station, char *end, u32 end_station) {
+	u32 *start_nodes = g->station_nodes + g->station_offsets[start_station];
+	u32 start_count = g->station_offsets[start_station + 1] - g->station_offsets[start_station];
+
+	if (ctx->mode == SEARCH_TABLE && ctx->table != NULL && ctx->table->version == ctx->version) {
+		return find_route_table(g, ctx, start, start_station, end, end_station);
+	}
+	if (ctx->mode == SEARCH_CH && ctx->hierarchy != NULL && ctx->hierarchy->version == ctx->version) {
+		return find_route_ch(g, ctx, start, start_nodes, start_count, end, end_station);
+	}
+	if (ctx->mode == SEARCH_DELTA) {
+		return find_route_delta(g, ctx, start, start_nodes, start_count, end, end_station);
+	}
+	if (ctx->mode == SEARCH_BIDIRECTIONAL) {
+		return find_route_bidirectional(g, ctx, start, start_nodes, start_count, end, end_station);
+	}
+	if (ctx->mode == SEARCH_ALT && ctx->landmarks != NULL && ctx->landmarks->version == ctx->version) {
+		return find_route_alt(g, ctx, start, start_nodes, start_count, end, end_station);
+	}
+	return find_route(g, ctx, start, start_nodes, start_count, end, end_station);
+}
+
+static Route *cached_route(Graph *g, SearchContext *ctx, CacheEntry *entry, char *start, char *end) {
+	search_begin(ctx, g);
+	if (entry->path_size == 0) {
+		return new_route(ctx->arena, entry->time, start, NO_NODE, end, NO_NODE);
+	}
+
+	Route *route = new_route(ctx->arena, entry->time, start, entry->path[0], end, entry->path[entry->path_size - 1]);
+	route->path = (u32 *)mem_alloc(ctx->arena, sizeof(u32) * entry->path_size);
+	memcpy(route->path, entry->path, sizeof(u32) * entry->path_size);
+	route->path_size = entry->path_size;
+	return route;
+}
+
+static Route *find_station_route(Graph *g, SearchContext *ctx, char *start, u32 start_station, char *end, u32 end_station) {
+	if (ctx->cache == NULL) {
+		return route_stations(g, ctx, start, start_station, end, end_station);
+	}
+
+	CacheEntry *entry = cache_get(ctx->cache, ctx->version, start_station, end_station);
+	if (entry != NULL) {
+		return cached_route(g, ctx, entry, start, end);
+	}
+	Route *route = route_stations(g, ctx, start, start_station, end, end_station);
+	cache_put(ctx->cache, ctx->version, start_station, end_station, route->accum_time, route->path, route->path_size);
+	return route;
+}
+
+/*
+ * The route lives in ctx's arena until the next query on ctx. With live
+ * updates on, the whole query runs against one pinned copy of the times.
+ */
+Route *find_best_route(Graph *g, SearchContext *ctx, char *start, char *end) {
+	STAT_CLOCK(lookup);
+	STAT_ADD(queries, 1);
+	u32 start_station = graph_find_station(g, start);
+	u32 end_station = graph_find_station(g, end);
+	STAT_PHASE(lookup_cycles, lookup);
+	if (start_station == NO_NODE || end_station == NO_NODE) {
+		return NULL;
+	}
+
+	STAT_CLOCK(search);
+	Route *route;
+	if (g->live == NULL) {
+		ctx->times = g->edge_times;
+		ctx->version = g->version;
+		route = find_station_route(g, ctx, start, start_station, end, end_station);
+	} else {
+		u32 slot = live_pin(g->live, &ctx->times, &ctx->version);
+		ctx->pinned = true;
+		route = find_station_route(g, ctx, start, start_station, end, end_station);
+		ctx->pinned = false;
+		live_unpin(g->live, slot);
+	}
+	STAT_PHASE(search_cycles, search);
+	STAT_ADD(nodes_settled, ctx->settled);
+	return route;
+}
+
+static char *search_mode_name(SearchMode mode) {
+	switch (mode) {
+		case SEARCH_ALT: return "alt";
+		case SEARCH_CH: return "ch";
+		case SEARCH_BIDIRECTIONAL: return "bidir";
+		case SEARCH_TABLE: return "table";
+		case SEARCH_DELTA: return "delta";
+		default: return "dijkstra";
+	}
+}
+
+/*
+ * Routes `queries` random station pairs with plain Dijkstra and with opts,
+ * checks the travel times agree and reports nodes settled per query.
+ */
+int search_report(Graph *g, SearchOptions *opts, u32 queries, u64 seed) {
+	if (g->station_count == 0) {
+		printf("empty network\n");
+		return 1;
+	}
+
+	SearchContext *plain = search_init(g->node_count);
+	SearchContext *tuned = search_init(g->node_count);
+	search_configure(tuned, opts);
+
+	u64 rng = seed ? seed : 1;
+	u64 plain_settled = 0;
+	u64 tuned_settled = 0;
+	u64 plain_cycles = 0;
+	u64 tuned_cycles = 0;
+	u32 mismatches = 0;
+
+	for (u32 q = 0; q < queries; q++) {
+		char *from = station_name(g, rng_next(&rng) % g->station_count);
+		char *to = station_name(g, rng_next(&rng) % g->station_count);
+
+		u64 start = common_rdtsc();
+		Route *a = find_best_route(g, plain, from, to);
+		plain_cycles += common_rdtsc() - start;
+
+		start = common_rdtsc();
+		Route *b = find_best_route(g, tuned, from, to);
+		tuned_cycles += common_rdtsc() - start;
+
+		plain_settled += plain->settled;
+		tuned_settled += tuned->settled;
+		if (fabsf(a->accum_time - b->accum_time) > 1e-3f && !(a->accum_time == INFINITY && b->accum_time == INFINITY)) {
+			mismatches++;
+			printf("mismatch %s -> %s: dijkstra %g, %s %g\n", from, to, a->accum_time, search_mode_name(opts->mode), b->accum_time);
+		}
+	}
+
+	char *name = search_mode_name(opts->mode);
+	printf("%u platforms, %u random queries\n", g->node_count, queries);
+	printf("  %-9s %.1f nodes settled/query, %.0f cycles/query\n", "dijkstra:", (f64)plain_settled / queries, (f64)plain_cycles / queries);
+	printf("  %s:%*s %.1f nodes settled/query, %.0f cycles/query\n", name, (int)(8 - strlen(name)), "", (f64)tuned_settled / queries, (f64)tuned_cycles / queries);
+	printf("  mismatched travel times: %u\n", mismatches);
+
+	search_free(plain);
+	search_free(tuned);
+	return mismatches ? 1 : 0;
+}
+
+void print_route(Graph *g, Route *route) {
+	printf("-------------\n");
+	printf("Trip Summary\n");
+	printf("   %s -> %s\n", route->start, route->end);
+	printf("-------------\n\n");
+	if (route->path == NULL) {
+		printf("  no route\n");
+		printf("-----------------------\n");
+		return;
+	}
+	for (u64 i = 0; i < route->path_size; i++) {
+		u32 current = route->path[i];
+		printf("  %s %s\n", node_name(g, current), node_line_name(g, current));
+	}
+	printf("\ntravel time: %.2g minutes\n", route->accum_time);
+	printf("-----------------------\n");
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <signal.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "common.h"
+#include "graph.h"
+#include "router.h"
+#include "arena.h"
+#include "json.h"
+#include "timetable.h"
+#include "prefix.h"
+
+/*
+ * Long running query mode. Requests are newline-delimited JSON objects
+ * such as {"from":"G","to":"Z"}; each one gets exactly one JSON line back,
+ * in order. {"op":"update"} patches edge times on the running graph (see
+ * live.h), {"op":"isochrone"} lists every station within a time budget and
+ * {"op":"complete"} finishes a typed station name. Input is read in large
+ * chunks and every complete line in a chunk is answered before the batch
+ * of responses goes out in one write, so pipelined clients pay one syscall
+ * per batch rather than per query. An "id" field, if present, is echoed
+ * back.
+ *
+ * A line longer than SERVER_MAX_LINE gets a single "line too long" error
+ * and is skipped up to its newline.
+ */
+
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_LINE (1024 * 1024)
+
+typedef struct Server {
+	Graph *g;
+	SearchContext *search;
+	Timetable *timetable;
+	RaptorState *raptor;
+	PrefixIndex *names;
+	StrBuf *out;
+	u64 requests;
+	// stations written so far by the running isochrone request
+	u32 isochrone_count;
+	// counters summed over every request, with -DTRAM_STATS
+	QueryStats stats;
+} Server;
+
+Server *server_init(Graph *g, SearchOptions *opts) {
+	Server *s = (Server *)malloc(sizeof(Server));
+	s->g = g;
+	s->search = search_init(g->node_count);
+	search_configure(s->search, opts);
+	s->timetable = (opts != NULL) ? opts->timetable : NULL;
+	s->raptor = (s->timetable != NULL) ? raptor_init(s->timetable) : NULL;
+	s->names = (opts != NULL) ? opts->names : NULL;
+	s->out = sb_init();
+	s->requests = 0;
+	s->isochrone_count = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+	return s;
+}
+
+void server_free(Server *s) {
+	search_free(s->search);
+	if (s->raptor != NULL) {
+		raptor_free(s->raptor);
+	}
+	sb_free(s->out);
+	free(s);
+}
+
+void write_route_json(Graph *g, Route *route, StrBuf *out) {
+	sb_puts(out, "\"from\":");
+	json_write_string(out, route->start);
+	sb_puts(out, ",\"to\":");
+	json_write_string(out, route->end);
+
+	if (route->path == NULL) {
+		sb_puts(out, ",\"error\":\"no route\"");
+		return;
+	}
+
+	sb_printf(out, ",\"time\":%g,\"path\":[", route->accum_time);
+	for (u64 i = 0; i < route->path_size; i++) {
+		u32 node = route->path[i];
+		sb_puts(out, (i == 0) ? "{\"station\":" : ",{\"station\":");
+		json_write_string(out, node_name(g, node));
+		sb_puts(out, ",\"line\":");
+		json_write_string(out, node_line_name(g, node));
+		sb_puts(out, "}");
+	}
+	sb_puts(out, "]");
+}
+
+static void write_error(StrBuf *out, char *error) {
+	sb_puts(out, "\"error\":");
+	json_write_string(out, error);
+}
+
+static void handle_route(Server *s, JsonObject *req, StrBuf *out) {
+	char *from = json_get_string(req, "from");
+	char *to = json_get_string(req, "to");
+	if (from == NULL || to == NULL) {
+		write_error(out, "route needs \"from\" and \"to\"");
+		return;
+	}
+
+	// {"depart":"08:14"} asks the timetable instead of the static network
+	char *depart = json_get_string(req, "depart");
+	u32 depart_time = NO_TIME;
+	if (depart != NULL) {
+		if (s->timetable == NULL) {
+			write_error(out, "no timetable loaded");
+			return;
+		}
+		depart_time = parse_clock((StrView){ depart, strlen(depart) });
+		if (depart_time == NO_TIME) {
+			write_error(out, "bad departure time");
+			return;
+		}
+	}
+
+	Route *route;
+	if (depart_time != NO_TIME) {
+		route = find_timetable_route(s->g, s->timetable, s->raptor, s->search, from, to, depart_time);
+	} else {
+		route = find_best_route(s->g, s->search, from, to);
+	}
+	if (route == NULL) {
+		write_error(out, "unknown station");
+		return;
+	}
+	write_route_json(s->g, route, out);
+	if (depart_time != NO_TIME && route->path != NULL) {
+		char clock[16];
+		format_clock(clock, sizeof(clock), depart_time + (u32)((route->accum_time * 60.0f) + 0.5f));
+		sb_puts(out, ",\"arrive\":");
+		json_write_string(out, clock);
+	}
+}
+
+static void write_isochrone_station(void *arg, u32 node, f32 time) {
+	Server *s = (Server *)arg;
+	sb_puts(s->out, (s->isochrone_count++ == 0) ? "{\"station\":" : ",{\"station\":");
+	json_write_string(s->out, node_name(s->g, node));
+	sb_puts(s->out, ",\"line\":");
+	json_write_string(s->out, node_line_name(s->g, node));
+	sb_printf(s->out, ",\"time\":%g}", time);
+}
+
+// {"op":"isochrone","from":"G","minutes":10}
+static void handle_isochrone(Server *s, JsonObject *req, StrBuf *out) {
+	char *from = json_get_string(req, "from");
+	f64 minutes;
+	if (from == NULL || !json_get_number(req, "minutes", &minutes)) {
+		write_error(out, "isochrone needs \"from\" and \"minutes\"");
+		return;
+	}
+	if (!(minutes >= 0)) {
+		write_error(out, "bad time budget");
+		return;
+	}
+
+	// Stations are written straight into the response as they settle
+	u64 mark = out->size;
+	sb_puts(out, "\"from\":");
+	json_write_string(out, from);
+	sb_printf(out, ",\"minutes\":%g,\"stations\":[", minutes);
+	s->isochrone_count = 0;
+	u32 count = find_isochrone(s->g, s->search, from, (f32)minutes, write_isochrone_station, s);
+	if (count == NO_NODE) {
+		out->size = mark;
+		write_error(out, "unknown station");
+		return;
+	}
+	sb_printf(out, "],\"count\":%u", count);
+}
+
+// {"op":"complete","prefix":"Ha","limit":5}
+static void handle_complete(Server *s, JsonObject *req, StrBuf *out) {
+	char *prefix = json_get_string(req, "prefix");
+	f64 limit = 10;
+	if (prefix == NULL) {
+		write_error(out, "complete needs \"prefix\"");
+		return;
+	}
+	if (json_get(req, "limit") != NULL && (!json_get_number(req, "limit", &limit) || !(limit >= 0))) {
+		write_error(out, "bad limit");
+		return;
+	}
+	if (s->names == NULL) {
+		write_error(out, "no name index");
+		return;
+	}
+
+	u32 stations[PREFIX_MAX_LIMIT];
+	u32 count = prefix_complete(s->names, s->g, prefix, strlen(prefix), stations, (limit < PREFIX_MAX_LIMIT) ? (u32)limit : PREFIX_MAX_LIMIT);
+	sb_puts(out, "\"prefix\":");
+	json_write_string(out, prefix);
+	sb_puts(out, ",\"stations\":[");
+	Graph *g = s->g;
+	for (u32 i = 0; i < count; i++) {
+		u32 station = stations[i];
+		sb_puts(out, (i == 0) ? "{\"station\":" : ",{\"station\":");
+		json_write_string(out, station_name(g, station));
+		sb_puts(out, ",\"lines\":[");
+		for (u32 k = g->station_offsets[station]; k < g->station_offsets[station + 1]; k++) {
+			if (k > g->station_offsets[station]) {
+				sb_puts(out, ",");
+			}
+			json_write_string(out, node_line_name(g, g->station_nodes[k]));
+		}
+		sb_puts(out, "]}");
+	}
+	sb_printf(out, "],\"count\":%u", count);
+}
+
+static void handle_stats(Server *s, StrBuf *out) {
+	sb_printf(out, "\"requests\":%llu", s->requests);
+	RouteCache *cache = s->search->cache;
+	if (cache != NULL) {
+		sb_printf(out, ",\"cache_hits\":%llu,\"cache_misses\":%llu,\"cache_hit_rate\":%.4f", cache->hits, cache->misses, cache_hit_rate(cache));
+		sb_printf(out, ",\"cache_entries\":%llu,\"cache_bytes\":%llu,\"cache_budget\":%llu", cache->entries->size, cache->bytes, cache->budget);
+		sb_printf(out, ",\"cache_evictions\":%llu,\"cache_invalidations\":%llu", cache->evictions, cache->invalidations);
+	}
+#ifdef TRAM_STATS
+	sb_puts(out, ",\"counters\":");
+	stats_write_json(out, &s->stats);
+#endif
+}
+
+// {"op":"update","cmd":"delay A GREEN B GREEN +3; close N BLUE M BLUE"}
+static void handle_update(Server *s, JsonObject *req, StrBuf *out) {
+	char *cmd = json_get_string(req, "cmd");
+	if (cmd == NULL) {
+		write_error(out, "update needs \"cmd\"");
+		return;
+	}
+	if (s->g->live == NULL) {
+		write_error(out, "live updates are off");
+		return;
+	}
+
+	u64 changed = 0;
+	char *error = live_command(s->g, cmd, strlen(cmd), &changed);
+	if (error) {
+		write_error(out, error);
+		return;
+	}
+	sb_printf(out, "\"edges\":%llu,\"version\":%llu", changed, __atomic_load_n(&s->g->version, __ATOMIC_ACQUIRE));
+}
+
+// Appends exactly one response line for one request line
+void handle_request(Server *s, char *line, u64 len) {
+	StrBuf *out = s->out;
+	JsonObject req;
+	s->requests++;
+#ifdef TRAM_STATS
+	memset(&tram_stats, 0, sizeof(tram_stats));
+#endif
+
+	sb_puts(out, "{");
+	if (!json_parse_object(line, len, &req)) {
+		write_error(out, "malformed request");
+		sb_puts(out, "}\n");
+		return;
+	}
+
+	JsonField *id = json_get(&req, "id");
+	if (id != NULL) {
+		sb_puts(out, "\"id\":");
+		if (id->is_string) {
+			json_write_string(out, id->value);
+		} else {
+			sb_puts(out, id->value);
+		}
+		sb_puts(out, ",");
+	}
+
+	char *op = json_get_string(&req, "op");
+	if (op == NULL || !strcmp(op, "route")) {
+		handle_route(s, &req, out);
+	} else if (!strcmp(op, "update")) {
+		handle_update(s, &req, out);
+	} else if (!strcmp(op, "isochrone")) {
+		handle_isochrone(s, &req, out);
+	} else if (!strcmp(op, "complete")) {
+		handle_complete(s, &req, out);
+	} else if (!strcmp(op, "stats")) {
+		handle_stats(s, out);
+	} else {
+		write_error(out, "unknown op");
+	}
+
+#ifdef TRAM_STATS
+	sb_puts(out, ",\"stats\":");
+	stats_write_json(out, &tram_stats);
+	stats_add(&s->stats, &tram_stats);
+#endif
+	sb_puts(out, "}\n");
+}
+
+static bool write_all(int fd, char *buffer, u64 size) {
+	while (size > 0) {
+		ssize_t written = write(fd, buffer, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		buffer += written;
+		size -= written;
+	}
+	return true;
+}
+
+static bool is_blank_line(char *line, u64 len) {
+	for (u64 i = 0; i < len; i++) {
+		if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Serves one stream until EOF; returns false on a write error
+bool serve_stream(Server *s, int in_fd, int out_fd) {
+	u64 capacity = SERVER_READ_SIZE * 2;
+	char *buffer = (char *)malloc(capacity);
+	u64 size = 0;
+	bool ok = true;
+	// inside an over-long line that has already been answered
+	bool skipping = false;
+
+	while (ok) {
+		if (capacity - size < SERVER_READ_SIZE && capacity < SERVER_MAX_LINE * 2) {
+			capacity *= 2;
+			buffer = (char *)realloc(buffer, capacity);
+		}
+
+		ssize_t got = read(in_fd, buffer + size, capacity - size);
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		bool eof = got <= 0;
+		if (!eof) {
+			size += got;
+		}
+
+		char *line = buffer;
+		char *end = buffer + size;
+		while (line < end) {
+			char *newline = (char *)memchr(line, '\n', end - line);
+			if (skipping) {
+				// Drop the rest of the line; it was answered when it got too long
+				skipping = newline == NULL;
+				line = (newline != NULL) ? newline + 1 : end;
+				continue;
+			}
+			if ((newline != NULL ? newline : end) - line > SERVER_MAX_LINE) {
+				s->requests++;
+				sb_puts(s->out, "{\"error\":\"line too long\"}\n");
+				skipping = newline == NULL;
+				line = (newline != NULL) ? newline + 1 : end;
+				continue;
+			}
+			if (newline == NULL) {
+				if (!eof) {
+					break;
+				}
+				newline = end;
+			}
+			if (!is_blank_line(line, newline - line)) {
+				handle_request(s, line, newline - line);
+			}
+			line = (newline < end) ? newline + 1 : end;
+		}
+
+		size = end - line;
+		memmove(buffer, line, size);
+
+		if (s->out->size > 0) {
+			ok = write_all(out_fd, s->out->buffer, s->out->size);
+			sb_clear(s->out);
+		}
+		if (eof) {
+			break;
+		}
+	}
+
+	free(buffer);
+	return ok;
+}
+
+static int serve_listener(Server *s, int listener) {
+	if (listen(listener, 16) < 0) {
+		perror("listen");
+		close(listener);
+		return 1;
+	}
+
+	while (true) {
+		int client = accept(listener, NULL, NULL);
+		if (client < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("accept");
+			break;
+		}
+		serve_stream(s, client, client);
+		close(client);
+	}
+
+	close(listener);
+	return 1;
+}
+
+int serve_unix(Server *s, char *path) {
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	unlink(path);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(listener);
+		return 1;
+	}
+
+	printf("serving on %s\n", path);
+	fflush(stdout);
+	return serve_listener(s, listener);
+}
+
+// Loopback only; the protocol has no authentication
+int serve_tcp(Server *s, u16 port) {
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	int yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		close(listener);
+		return 1;
+	}
+
+	printf("serving on 127.0.0.1:%u\n", port);
+	fflush(stdout);
+	return serve_listener(s, listener);
+}
+
+int run_server(Graph *g, SearchOptions *opts, char *unix_path, u16 port, char *updates_path) {
+	signal(SIGPIPE, SIG_IGN);
+	if (g->live == NULL) {
+		live_init(g);
+	}
+	if (updates_path != NULL) {
+		live_follow(g, updates_path);
+	}
+	Server *s = server_init(g, opts);
+
+	int ret = 0;
+	if (unix_path != NULL) {
+		ret = serve_unix(s, unix_path);
+	} else if (port != 0) {
+		ret = serve_tcp(s, port);
+	} else {
+		ret = serve_stream(s, STDIN_FILENO, STDOUT_FILENO) ? 0 : 1;
+	}
+
+	server_free(s);
+	return ret;
+}
+
+#endif
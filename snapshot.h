@@ -0,0 +1,286 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "common.h"
+#include "file_helper.h"
+#include "hashmap.h"
+#include "graph.h"
+#include "arena.h"
+
+/*
+ * Binary image of a built Graph. Every array, the packed name table and the
+ * raw slots of the three interning HashMaps are written as 16 byte aligned
+ * sections behind a fixed header. Loading maps the file and points the Graph
+ * straight at those sections, so there is nothing to deserialize. HashMap
+ * slots only hold offsets and ids, never pointers, so they survive the trip
+ * as they are. A mapped Graph is read-only.
+ *
+ * The image uses native byte order and struct layout, and bakes in hm_hash,
+ * so bump SNAPSHOT_VERSION whenever any of those change.
+ */
+
+#define SNAPSHOT_MAGIC "TRAMSNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN 16
+
+enum {
+	SEC_NODE_STATION,
+	SEC_NODE_LINE,
+	SEC_EDGE_OFFSETS,
+	SEC_EDGE_TARGETS,
+	SEC_EDGE_TIMES,
+	SEC_STATION_OFFSETS,
+	SEC_STATION_NODES,
+	SEC_STRINGS,
+	SEC_STATION_NAME_OFF,
+	SEC_LINE_NAME_OFF,
+	SEC_NODE_IDS,
+	SEC_NODE_ID_KEYS,
+	SEC_STATION_IDS,
+	SEC_STATION_ID_KEYS,
+	SEC_LINE_IDS,
+	SEC_LINE_ID_KEYS,
+	SECTION_COUNT
+};
+
+typedef struct SnapshotSection {
+	u64 offset;
+	u64 size;
+} SnapshotSection;
+
+typedef struct SnapshotHeader {
+	char magic[8];
+	u32 version;
+	u32 section_count;
+	u64 file_size;
+	u64 checksum;
+	u32 node_count;
+	u32 edge_count;
+	u32 station_count;
+	u32 line_count;
+	u64 map_sizes[3];
+	SnapshotSection sections[SECTION_COUNT];
+} SnapshotHeader;
+
+static u64 align_up(u64 x, u64 align) {
+	return (x + (align - 1)) & ~(align - 1);
+}
+
+// FNV-style fold over 8 byte words, tail zero padded
+u64 snapshot_checksum(u64 hash, u8 *data, u64 size) {
+	u64 i = 0;
+	for (; i + 8 <= size; i += 8) {
+		u64 word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	if (i < size) {
+		u64 word = 0;
+		memcpy(&word, data + i, size - i);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+// Identifies a network's edges, so data derived from it can detect staleness
+u64 graph_checksum(Graph *g) {
+	u64 hash = 0xcbf29ce484222325ull;
+	hash = snapshot_checksum(hash, (u8 *)g->edge_offsets, sizeof(u32) * (g->node_count + 1));
+	hash = snapshot_checksum(hash, (u8 *)g->edge_targets, sizeof(u32) * g->edge_count);
+	return snapshot_checksum(hash, (u8 *)g->edge_times, sizeof(f32) * g->edge_count);
+}
+
+static void snapshot_sources(Graph *g, void **data, u64 *sizes) {
+	data[SEC_NODE_STATION] = g->node_station;
+	sizes[SEC_NODE_STATION] = sizeof(u32) * g->node_count;
+	data[SEC_NODE_LINE] = g->node_line;
+	sizes[SEC_NODE_LINE] = sizeof(u32) * g->node_count;
+	data[SEC_EDGE_OFFSETS] = g->edge_offsets;
+	sizes[SEC_EDGE_OFFSETS] = sizeof(u32) * (g->node_count + 1);
+	data[SEC_EDGE_TARGETS] = g->edge_targets;
+	sizes[SEC_EDGE_TARGETS] = sizeof(u32) * g->edge_count;
+	data[SEC_EDGE_TIMES] = g->edge_times;
+	sizes[SEC_EDGE_TIMES] = sizeof(f32) * g->edge_count;
+	data[SEC_STATION_OFFSETS] = g->station_offsets;
+	sizes[SEC_STATION_OFFSETS] = sizeof(u32) * (g->station_count + 1);
+	data[SEC_STATION_NODES] = g->station_nodes;
+	sizes[SEC_STATION_NODES] = sizeof(u32) * g->node_count;
+	data[SEC_STRINGS] = g->strings;
+	sizes[SEC_STRINGS] = g->strings_size;
+	data[SEC_STATION_NAME_OFF] = g->station_name_off;
+	sizes[SEC_STATION_NAME_OFF] = sizeof(u32) * g->station_count;
+	data[SEC_LINE_NAME_OFF] = g->line_name_off;
+	sizes[SEC_LINE_NAME_OFF] = sizeof(u32) * g->line_count;
+
+	HashMap *maps[3] = { g->node_ids, g->station_ids, g->line_ids };
+	for (u32 i = 0; i < 3; i++) {
+		hm_finish_grow(maps[i]);
+		data[SEC_NODE_IDS + (i * 2)] = maps[i]->map;
+		sizes[SEC_NODE_IDS + (i * 2)] = sizeof(HMNode) * maps[i]->capacity;
+		data[SEC_NODE_ID_KEYS + (i * 2)] = maps[i]->keys;
+		sizes[SEC_NODE_ID_KEYS + (i * 2)] = maps[i]->keys_size;
+	}
+}
+
+/*
+ * Lays sections out behind a header of header_size bytes, fills in their
+ * offsets and the running checksum, and returns the padded file size.
+ */
+u64 sections_layout(u64 header_size, SnapshotSection *sections, void **data, u64 *sizes, u32 count, u64 *checksum) {
+	u64 offset = align_up(header_size, SNAPSHOT_ALIGN);
+	*checksum = 0xcbf29ce484222325ull;
+	for (u32 i = 0; i < count; i++) {
+		sections[i].offset = offset;
+		sections[i].size = sizes[i];
+		*checksum = snapshot_checksum(*checksum, (u8 *)data[i], sizes[i]);
+		offset = align_up(offset + sizes[i], SNAPSHOT_ALIGN);
+	}
+	return offset;
+}
+
+bool sections_write(char *filename, void *header, u64 header_size, SnapshotSection *sections, void **data, u32 count, u64 file_size) {
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL) {
+		printf("could not open %s for writing!\n", filename);
+		return false;
+	}
+
+	u8 padding[SNAPSHOT_ALIGN] = {0};
+	bool ok = fwrite(header, header_size, 1, file) == 1;
+	u64 written = header_size;
+	for (u32 i = 0; i < count && ok; i++) {
+		u64 pad = sections[i].offset - written;
+		ok = fwrite(padding, 1, pad, file) == pad;
+		if (sections[i].size > 0) {
+			ok = ok && fwrite(data[i], 1, sections[i].size, file) == sections[i].size;
+		}
+		written = sections[i].offset + sections[i].size;
+	}
+	u64 pad = file_size - written;
+	ok = ok && fwrite(padding, 1, pad, file) == pad;
+
+	if (fclose(file) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		printf("failed writing %s!\n", filename);
+	}
+	return ok;
+}
+
+// Bounds checks a mapped section table, and the checksum when verify is set
+char *sections_check(File *file, u64 file_size, SnapshotSection *sections, u32 count, bool verify, u64 checksum) {
+	if (file_size != file->size) {
+		return "truncated file";
+	}
+	for (u32 i = 0; i < count; i++) {
+		SnapshotSection sec = sections[i];
+		if (sec.offset % SNAPSHOT_ALIGN || sec.offset > file->size || sec.size > file->size - sec.offset) {
+			return "corrupt section table";
+		}
+	}
+	if (verify) {
+		u64 actual = 0xcbf29ce484222325ull;
+		for (u32 i = 0; i < count; i++) {
+			actual = snapshot_checksum(actual, (u8 *)file->string + sections[i].offset, sections[i].size);
+		}
+		if (actual != checksum) {
+			return "checksum mismatch";
+		}
+	}
+	return NULL;
+}
+
+bool snapshot_write(Graph *g, char *filename) {
+	void *data[SECTION_COUNT];
+	u64 sizes[SECTION_COUNT];
+	snapshot_sources(g, data, sizes);
+
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+	header.version = SNAPSHOT_VERSION;
+	header.section_count = SECTION_COUNT;
+	header.node_count = g->node_count;
+	header.edge_count = g->edge_count;
+	header.station_count = g->station_count;
+	header.line_count = g->line_count;
+	header.map_sizes[0] = g->node_ids->size;
+	header.map_sizes[1] = g->station_ids->size;
+	header.map_sizes[2] = g->line_ids->size;
+	header.file_size = sections_layout(sizeof(header), header.sections, data, sizes, SECTION_COUNT, &header.checksum);
+
+	return sections_write(filename, &header, sizeof(header), header.sections, data, SECTION_COUNT, header.file_size);
+}
+
+static HashMap *snapshot_map(Arena *arena, u8 *base, SnapshotSection slots, SnapshotSection keys, u64 size) {
+	HashMap *hm = (HashMap *)mem_calloc(arena, 1, sizeof(HashMap));
+	hm->map = (HMNode *)(base + slots.offset);
+	hm->capacity = slots.size / sizeof(HMNode);
+	hm->mask = hm->capacity - 1;
+	hm->keys = (char *)(base + keys.offset);
+	hm->keys_size = keys.size;
+	hm->keys_capacity = keys.size;
+	hm->size = size;
+	return hm;
+}
+
+/*
+ * Maps a snapshot and wires a Graph to it. With verify set the checksum is
+ * recomputed, which reads every page once; otherwise only the header and
+ * section bounds are checked.
+ */
+Graph *snapshot_load(char *filename, bool verify) {
+	File *file = map_file(filename);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	SnapshotHeader *header = (SnapshotHeader *)file->string;
+	char *error = NULL;
+	if (file->size < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, 8)) {
+		error = "not a snapshot";
+	} else if (header->version != SNAPSHOT_VERSION || header->section_count != SECTION_COUNT) {
+		error = "unsupported snapshot version";
+	} else {
+		error = sections_check(file, header->file_size, header->sections, SECTION_COUNT, verify, header->checksum);
+	}
+
+	u8 *base = (u8 *)file->string;
+	if (error) {
+		printf("%s: %s!\n", filename, error);
+		close_file(file);
+		return NULL;
+	}
+
+	Arena *arena = arena_sized_init(4096);
+	Graph *g = (Graph *)mem_calloc(arena, 1, sizeof(Graph));
+	g->arena = arena;
+	g->snapshot = file;
+
+	SnapshotSection *sec = header->sections;
+	g->node_count = header->node_count;
+	g->edge_count = header->edge_count;
+	g->station_count = header->station_count;
+	g->line_count = header->line_count;
+	g->node_station = (u32 *)(base + sec[SEC_NODE_STATION].offset);
+	g->node_line = (u32 *)(base + sec[SEC_NODE_LINE].offset);
+	g->edge_offsets = (u32 *)(base + sec[SEC_EDGE_OFFSETS].offset);
+	g->edge_targets = (u32 *)(base + sec[SEC_EDGE_TARGETS].offset);
+	g->edge_times = (f32 *)(base + sec[SEC_EDGE_TIMES].offset);
+	g->station_offsets = (u32 *)(base + sec[SEC_STATION_OFFSETS].offset);
+	g->station_nodes = (u32 *)(base + sec[SEC_STATION_NODES].offset);
+	g->strings = (char *)(base + sec[SEC_STRINGS].offset);
+	g->strings_size = sec[SEC_STRINGS].size;
+	g->station_name_off = (u32 *)(base + sec[SEC_STATION_NAME_OFF].offset);
+	g->line_name_off = (u32 *)(base + sec[SEC_LINE_NAME_OFF].offset);
+	g->node_ids = snapshot_map(arena, base, sec[SEC_NODE_IDS], sec[SEC_NODE_ID_KEYS], header->map_sizes[0]);
+	g->station_ids = snapshot_map(arena, base, sec[SEC_STATION_IDS], sec[SEC_STATION_ID_KEYS], header->map_sizes[1]);
+	g->line_ids = snapshot_map(arena, base, sec[SEC_LINE_IDS], sec[SEC_LINE_ID_KEYS], header->map_sizes[2]);
+
+	return g;
+}
+
+#endif
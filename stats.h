@@ -0,0 +1,103 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "common.h"
+#include "json.h"
+
+/*
+ * Hot path counters, compiled in with -DTRAM_STATS and to nothing otherwise,
+ * the same way debug() works. Each thread counts into its own tram_stats, so
+ * batch workers never share a cache line; callers reset it before a query
+ * and read it afterwards. Phase cycles come from common_rdtsc, which
+ * serializes the pipeline, so builds with counters on run a little slower.
+ * search_cycles covers the whole routing call, path_cycles included.
+ *
+ * With counters on, every server response carries its query's counters in
+ * a "stats" object, {"op":"stats"} reports the running totals, and batch
+ * and bench print totals for the run.
+ *
+ * Searches split over a worker pool (delta.h, matrix.h) count on the pool's
+ * threads. Each pool function marks tram_stats on entry and moves what it
+ * added into its worker's slot on exit, and the caller folds the slots into
+ * its own tram_stats once the run is over.
+ */
+
+typedef struct QueryStats {
+	u64 queries;
+	u64 nodes_settled;
+	u64 edges_relaxed;
+	u64 heap_pushes;
+	u64 heap_pops;
+	// pushes of an id already queued, turned into a decrease-key or dropped
+	u64 heap_duplicates;
+	u64 hash_lookups;
+	u64 hash_inserts;
+	u64 hash_probes;
+	u64 hash_max_probe;
+	u64 array_reallocs;
+	u64 lookup_cycles;
+	u64 search_cycles;
+	u64 path_cycles;
+} QueryStats;
+
+#ifdef TRAM_STATS
+static __thread QueryStats tram_stats;
+
+#define STAT_ADD(field, n) (tram_stats.field += (n))
+#define STAT_MAX(field, v) do { if ((u64)(v) > tram_stats.field) { tram_stats.field = (v); } } while (0)
+#define STAT_CLOCK(name) u64 name = common_rdtsc()
+#define STAT_PHASE(field, since) (tram_stats.field += common_rdtsc() - (since))
+#define STAT_MARK(name) QueryStats name = tram_stats
+#define STAT_MOVE(slot, mark) stats_move((slot), &(mark))
+#define STAT_FOLD(slots, count) stats_fold((slots), (count))
+#else
+#define STAT_ADD(field, n)
+#define STAT_MAX(field, v)
+#define STAT_CLOCK(name)
+#define STAT_PHASE(field, since)
+#define STAT_MARK(name)
+#define STAT_MOVE(slot, mark)
+#define STAT_FOLD(slots, count)
+#endif
+
+void stats_add(QueryStats *total, QueryStats *stats) {
+	u64 max_probe = (stats->hash_max_probe > total->hash_max_probe) ? stats->hash_max_probe : total->hash_max_probe;
+	u64 *dst = (u64 *)total;
+	u64 *src = (u64 *)stats;
+	for (u64 i = 0; i < sizeof(QueryStats) / sizeof(u64); i++) {
+		dst[i] += src[i];
+	}
+	total->hash_max_probe = max_probe;
+}
+
+#ifdef TRAM_STATS
+// Adds what this thread counted since mark to slot and rolls tram_stats back to mark
+void stats_move(QueryStats *slot, QueryStats *mark) {
+	u64 *dst = (u64 *)slot;
+	u64 *now = (u64 *)&tram_stats;
+	u64 *then = (u64 *)mark;
+	for (u64 i = 0; i < sizeof(QueryStats) / sizeof(u64); i++) {
+		dst[i] += now[i] - then[i];
+	}
+	slot->hash_max_probe = (tram_stats.hash_max_probe > slot->hash_max_probe) ? tram_stats.hash_max_probe : slot->hash_max_probe;
+	tram_stats = *mark;
+}
+
+void stats_fold(QueryStats *slots, u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		stats_add(&tram_stats, &slots[i]);
+		memset(&slots[i], 0, sizeof(QueryStats));
+	}
+}
+#endif
+
+// {"queries":1,"settled":...}; the names match QueryStats minus suffixes
+void stats_write_json(StrBuf *out, QueryStats *stats) {
+	sb_printf(out, "{\"queries\":%llu,\"settled\":%llu,\"relaxed\":%llu", stats->queries, stats->nodes_settled, stats->edges_relaxed);
+	sb_printf(out, ",\"heap_pushes\":%llu,\"heap_pops\":%llu,\"heap_duplicates\":%llu", stats->heap_pushes, stats->heap_pops, stats->heap_duplicates);
+	sb_printf(out, ",\"hash_lookups\":%llu,\"hash_inserts\":%llu,\"hash_probes\":%llu,\"hash_max_probe\":%llu", stats->hash_lookups, stats->hash_inserts, stats->hash_probes, stats->hash_max_probe);
+	sb_printf(out, ",\"array_reallocs\":%llu", stats->array_reallocs);
+	sb_printf(out, ",\"lookup_cycles\":%llu,\"search_cycles\":%llu,\"path_cycles\":%llu}", stats->lookup_cycles, stats->search_cycles, stats->path_cycles);
+}
+
+#endif
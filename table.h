@@ -0,0 +1,189 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <math.h>
+
+#include "common.h"
+#include "file_helper.h"
+#include "graph.h"
+#include "router.h"
+#include "snapshot.h"
+#include "pool.h"
+
+/*
+ * All-pairs station table. One Dijkstra per destination station, seeded
+ * from all of its platforms, gives that station's row: the best time from
+ * every station, the platform each trip starts on, and for every platform
+ * the next hop towards the destination. The network is symmetric, so the
+ * search tree grown out of the destination is walked forwards. Rows are
+ * independent and split across a worker pool, each worker with its own
+ * SearchContext. The file is laid out like the snapshot and mapped as is.
+ *
+ * Memory is S * S * 8 + S * N * 4 bytes for S stations and N platforms.
+ */
+
+#define TABLE_MAGIC "TRAMTABL"
+#define TABLE_VERSION 1
+
+enum {
+	TABLE_TIMES,
+	TABLE_ENTRY,
+	TABLE_HOPS,
+	TABLE_SECTION_COUNT
+};
+
+typedef struct TableHeader {
+	char magic[8];
+	u32 version;
+	u32 section_count;
+	u64 file_size;
+	u64 checksum;
+	u64 graph_checksum;
+	u32 station_count;
+	u32 node_count;
+	SnapshotSection sections[TABLE_SECTION_COUNT];
+} TableHeader;
+
+typedef struct TableBuild {
+	Graph *g;
+	RouteTable *table;
+	SearchContext **workers;
+} TableBuild;
+
+static void table_worker(void *arg, u32 worker, u64 begin, u64 end) {
+	TableBuild *build = (TableBuild *)arg;
+	Graph *g = build->g;
+	RouteTable *table = build->table;
+	SearchContext *ctx = build->workers[worker];
+
+	for (u64 t = begin; t < end; t++) {
+		u32 *targets = g->station_nodes + g->station_offsets[t];
+		u32 target_count = g->station_offsets[t + 1] - g->station_offsets[t];
+		search_dijkstra(g, ctx, targets, target_count, NO_NODE);
+
+		u32 *hops = table->hops + (t * table->node_count);
+		for (u32 v = 0; v < g->node_count; v++) {
+			hops[v] = (ctx->stamp[v] == ctx->generation) ? ctx->from[v] : NO_NODE;
+		}
+
+		f32 *times = table->times + (t * table->station_count);
+		u32 *entry = table->entry + (t * table->station_count);
+		for (u32 s = 0; s < g->station_count; s++) {
+			times[s] = INFINITY;
+			entry[s] = NO_NODE;
+			for (u32 i = g->station_offsets[s]; i < g->station_offsets[s + 1]; i++) {
+				u32 node = g->station_nodes[i];
+				f32 cost = search_cost(ctx, node);
+				if (cost < times[s]) {
+					times[s] = cost;
+					entry[s] = node;
+				}
+			}
+		}
+	}
+}
+
+RouteTable *table_build(Graph *g, u32 thread_count) {
+	RouteTable *table = (RouteTable *)calloc(1, sizeof(RouteTable));
+	table->version = g->version;
+	table->station_count = g->station_count;
+	table->node_count = g->node_count;
+	u64 cells = (u64)g->station_count * g->station_count;
+	table->times = (f32 *)malloc(sizeof(f32) * (cells + 1));
+	table->entry = (u32 *)malloc(sizeof(u32) * (cells + 1));
+	table->hops = (u32 *)malloc(sizeof(u32) * ((u64)g->station_count * g->node_count + 1));
+
+	TableBuild build = { g, table, (SearchContext **)malloc(sizeof(SearchContext *) * thread_count) };
+	for (u32 i = 0; i < thread_count; i++) {
+		build.workers[i] = search_init(g->node_count);
+	}
+
+	WorkerPool *pool = pool_init(thread_count);
+	pool_run(pool, table_worker, &build, g->station_count, 4);
+	pool_free(pool);
+
+	for (u32 i = 0; i < thread_count; i++) {
+		search_free(build.workers[i]);
+	}
+	free(build.workers);
+	return table;
+}
+
+void table_free(RouteTable *table) {
+	if (table->file != NULL) {
+		close_file(table->file);
+	} else {
+		free(table->times);
+		free(table->entry);
+		free(table->hops);
+	}
+	free(table);
+}
+
+bool table_write(RouteTable *table, Graph *g, char *filename) {
+	u64 cells = (u64)table->station_count * table->station_count;
+	void *data[TABLE_SECTION_COUNT] = { table->times, table->entry, table->hops };
+	u64 sizes[TABLE_SECTION_COUNT] = {
+		sizeof(f32) * cells,
+		sizeof(u32) * cells,
+		sizeof(u32) * table->station_count * table->node_count,
+	};
+
+	TableHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TABLE_MAGIC, 8);
+	header.version = TABLE_VERSION;
+	header.section_count = TABLE_SECTION_COUNT;
+	header.graph_checksum = graph_checksum(g);
+	header.station_count = table->station_count;
+	header.node_count = table->node_count;
+	header.file_size = sections_layout(sizeof(header), header.sections, data, sizes, TABLE_SECTION_COUNT, &header.checksum);
+
+	return sections_write(filename, &header, sizeof(header), header.sections, data, TABLE_SECTION_COUNT, header.file_size);
+}
+
+/*
+ * Maps a saved table; NULL if it is missing, corrupt or built from another
+ * graph. The checksum is not verified, since that would touch every page
+ * of what can be a large file; bounds and the graph identity still are.
+ */
+RouteTable *table_load(Graph *g, char *filename) {
+	File *file = map_file(filename);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	TableHeader *header = (TableHeader *)file->string;
+	char *error = NULL;
+	if (file->size < sizeof(TableHeader) || memcmp(header->magic, TABLE_MAGIC, 8)) {
+		error = "not a route table";
+	} else if (header->version != TABLE_VERSION || header->section_count != TABLE_SECTION_COUNT) {
+		error = "unsupported route table version";
+	} else if (header->station_count != g->station_count || header->node_count != g->node_count || header->graph_checksum != graph_checksum(g)) {
+		error = "built from a different network";
+	} else {
+		error = sections_check(file, header->file_size, header->sections, TABLE_SECTION_COUNT, false, header->checksum);
+	}
+
+	if (error) {
+		printf("%s: %s!\n", filename, error);
+		close_file(file);
+		return NULL;
+	}
+
+	// Lookups land anywhere in the file, so don't read ahead
+	madvise(file->string, file->size, MADV_RANDOM);
+
+	u8 *base = (u8 *)file->string;
+	RouteTable *table = (RouteTable *)calloc(1, sizeof(RouteTable));
+	table->file = file;
+	table->version = g->version;
+	table->station_count = header->station_count;
+	table->node_count = header->node_count;
+	table->times = (f32 *)(base + header->sections[TABLE_TIMES].offset);
+	table->entry = (u32 *)(base + header->sections[TABLE_ENTRY].offset);
+	table->hops = (u32 *)(base + header->sections[TABLE_HOPS].offset);
+	return table;
+}
+
+#endif
@@ -1,2 +1,4 @@
 clang -O3 test_hashmap.c -o test
 ./test
+clang -O3 test_pqueue.c -o test_pq
+./test_pq
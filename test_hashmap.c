@@ -61,7 +61,37 @@ int main() {
 	}
 	printf("Removal took: %llu ms\n", get_time_ms() - start);
 
-	assert(!map->idx_map_size && !map->size);
+	assert(!map->size);
+
+	hm_free(map);
+
+	// Incremental growth: every key stays reachable while tables are drained
+	map = hm_init();
+	hm_set_incremental(map, true);
+	start = get_time_ms();
+	for (u64 i = 0; i < test_size; i++) {
+		hm_insert(&map, keys[i], (void *)data[i]);
+		if (map->old_map != NULL) {
+			assert(hm_get(map, keys[i / 2]) == data[i / 2]);
+		}
+	}
+	printf("Incremental allocation took: %llu ms\n", get_time_ms() - start);
+
+	for (u64 i = 0; i < test_size; i += 2) {
+		ret = hm_remove(map, keys[i]);
+		assert(ret == true);
+	}
+	u64 seen = 0;
+	HMIter iter = { 0 };
+	while (hm_iter_key(map, &iter) != NULL) {
+		seen++;
+	}
+	assert(seen == map->size);
+	for (u64 i = 0; i < test_size; i++) {
+		char *result = (char *)hm_get(map, keys[i]);
+		assert(result == ((i & 1) ? data[i] : NULL));
+	}
+	printf("Finished incremental check\n");
 
 	hm_free(map);
 }
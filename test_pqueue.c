@@ -0,0 +1,82 @@
+#include "pqueue.h"
+#include "stdlib.h"
+#include "assert.h"
+
+#define FLOATVOID(x) ((void *)((u64)(x)))
+
+// Checked after the timed loops, so the asserts don't count towards them
+static void check_sorted(f32 *popped, u64 test_size) {
+	for (u64 i = 1; i < test_size; i++) {
+		assert(popped[i] >= popped[i - 1]);
+	}
+}
+
+void bench_indexed_heap(f32 *keys, f32 *popped, u64 test_size, u32 arity) {
+	IndexedHeap *ih = ih_init(test_size, arity);
+
+	u64 start = get_time_ms();
+	for (u64 i = 0; i < test_size; i++) {
+		ih_push(ih, i, keys[i]);
+	}
+	printf("[%u-ary indexed] Push took: %llu ms\n", arity, get_time_ms() - start);
+
+	start = get_time_ms();
+	for (u64 i = 0; i < test_size; i++) {
+		ih_pop(ih, &popped[i]);
+	}
+	printf("[%u-ary indexed] Pop took: %llu ms\n", arity, get_time_ms() - start);
+	check_sorted(popped, test_size);
+
+	ih_free(ih);
+}
+
+int main() {
+	u64 test_size = 1000000;
+	f32 *keys = malloc(sizeof(f32) * test_size);
+	f32 *popped = malloc(sizeof(f32) * test_size);
+	srand(1);
+	for (u64 i = 0; i < test_size; i++) {
+		keys[i] = (f32)(rand() % 100000) / 10.0f;
+	}
+
+	printf("Built dataset!\n");
+
+	IndexedHeap *ih = ih_init(8, 4);
+	ih_push(ih, 3, 5.0f);
+	ih_push(ih, 1, 2.0f);
+	ih_push(ih, 7, 9.0f);
+	ih_push(ih, 7, 1.0f);
+	ih_push(ih, 1, 4.0f);
+	assert(ih->size == 3);
+
+	f32 key;
+	assert(ih_pop(ih, &key) == 7 && key == 1.0f);
+	assert(ih_pop(ih, &key) == 1 && key == 2.0f);
+	assert(ih_pop(ih, &key) == 3 && key == 5.0f);
+	assert(!ih_contains(ih, 3));
+	ih_free(ih);
+	printf("Finished quick check\n");
+
+	PriorityQueue *pq = pq_init();
+	u64 start = get_time_ms();
+	for (u64 i = 0; i < test_size; i++) {
+		pq_push(pq, FLOATVOID(i + 1), keys[i]);
+	}
+	printf("[binary pointer] Push took: %llu ms\n", get_time_ms() - start);
+
+	start = get_time_ms();
+	for (u64 i = 0; i < test_size; i++) {
+		popped[i] = ((PriorityNode *)pq->heap->buffer[0])->priority;
+		pq_pop(pq);
+	}
+	printf("[binary pointer] Pop took: %llu ms\n", get_time_ms() - start);
+	check_sorted(popped, test_size);
+	pq_free(pq);
+
+	bench_indexed_heap(keys, popped, test_size, 2);
+	bench_indexed_heap(keys, popped, test_size, 4);
+	bench_indexed_heap(keys, popped, test_size, 8);
+
+	free(popped);
+	free(keys);
+}
@@ -0,0 +1,664 @@
+#ifndef TIMETABLE_H
+#define TIMETABLE_H
+
+#include "common.h"
+#include "arena.h"
+#include "hashmap.h"
+#include "file_helper.h"
+#include "graph.h"
+#include "router.h"
+
+/*
+ * Scheduled routing. A timetable file lists one trip per line:
+ *
+ *   GREEN, A 08:00, B 08:02, C 08:04
+ *   GREEN, A 05:00, B 05:02, C 05:04, every 10 until 24:00
+ *
+ * Station and line names are the ones stations.log uses, and every stop
+ * must be a platform of the static network, so both modes share the same
+ * names, ids and route output. The optional last field repeats the trip
+ * at a fixed headway. Times are HH:MM or HH:MM:SS and may pass 24:00.
+ *
+ * Trips with the same line and stop sequence form a pattern ("route" in
+ * RAPTOR terms), stored trip-major in one flat array, trips sorted by
+ * departure. Queries are RAPTOR earliest-arrival: round k scans, once each,
+ * the patterns serving a station improved in round k - 1, boarding the
+ * earliest catchable trip by binary search. Trips in a pattern are assumed
+ * not to overtake each other. Changing trips at a station costs that
+ * station's quickest transfer edge in stations.log.
+ */
+
+#define RAPTOR_MAX_ROUNDS 8
+// longest stop sequence one trip line may list
+#define MAX_TRIP_STOPS 256
+#define NO_TIME ((u32)-1)
+
+typedef struct Timetable {
+	u32 station_count;
+	u32 pattern_count;
+	u32 trip_count;
+
+	// platforms each pattern stops at, in order
+	u32 *pattern_stop_offsets;
+	u32 *pattern_stops;
+	// trip count and start of each pattern's trips * stops block of times
+	u32 *pattern_trips;
+	u32 *pattern_time_offsets;
+	u32 *times;
+
+	// (pattern, position) pairs serving each station
+	u32 *station_pattern_offsets;
+	u32 *station_patterns;
+	u32 *station_positions;
+
+	// seconds needed to change trips at each station
+	u32 *change_times;
+
+	Arena *arena;
+} Timetable;
+
+typedef struct RaptorLabel {
+	u32 pattern;
+	u32 trip;
+	u32 board;
+	u32 alight;
+} RaptorLabel;
+
+// Per worker query scratch, like SearchContext
+typedef struct RaptorState {
+	u32 station_count;
+	u32 pattern_count;
+	u32 *arrival;
+	u32 *best;
+	RaptorLabel *labels;
+	bool *marked;
+	u32 *marked_list;
+	u32 marked_count;
+	u32 *queue_pos;
+	u32 *queue_list;
+	u32 rounds;
+} RaptorState;
+
+// Seconds since midnight from HH:MM or HH:MM:SS, NO_TIME if malformed
+u32 parse_clock(StrView v) {
+	u32 parts[3] = { 0, 0, 0 };
+	u32 part = 0;
+	u32 digits = 0;
+	for (u64 i = 0; i < v.len; i++) {
+		char c = v.ptr[i];
+		if (c >= '0' && c <= '9') {
+			parts[part] = (parts[part] * 10) + (c - '0');
+			digits++;
+		} else if (c == ':' && digits > 0 && part < 2) {
+			part++;
+			digits = 0;
+		} else {
+			return NO_TIME;
+		}
+	}
+	if (part == 0 || digits == 0 || parts[1] >= 60 || parts[2] >= 60) {
+		return NO_TIME;
+	}
+	return (parts[0] * 3600) + (parts[1] * 60) + parts[2];
+}
+
+void format_clock(char *buffer, u64 size, u32 seconds) {
+	if (seconds % 60) {
+		snprintf(buffer, size, "%02u:%02u:%02u", seconds / 3600, (seconds / 60) % 60, seconds % 60);
+	} else {
+		snprintf(buffer, size, "%02u:%02u", seconds / 3600, (seconds / 60) % 60);
+	}
+}
+
+static StrView tt_trim(char *start, char *end) {
+	while (start < end && (*start == ' ' || *start == '\t' || *start == '\r')) {
+		start++;
+	}
+	while (end > start && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+		end--;
+	}
+	return (StrView){ start, (u64)(end - start) };
+}
+
+static u32 tt_find_platform(Graph *g, StrView station, StrView line) {
+	if (station.len > MAX_NAME_LEN || line.len > MAX_NAME_LEN) {
+		return NO_NODE;
+	}
+	char key[MAX_KEY_LEN];
+	u64 key_len = node_key_view(key, station, line);
+	void *id = hm_getn(g->node_ids, key, key_len);
+	return id ? VOIDID(id) : NO_NODE;
+}
+
+typedef struct TripList {
+	u32 *stops;
+	u32 *times;
+	u64 size;
+	u64 capacity;
+	// per trip: pattern, first departure, offset into stops/times
+	u32 *trip_pattern;
+	u32 *trip_start;
+	u32 *trip_offset;
+	u32 count;
+	u32 trip_capacity;
+} TripList;
+
+static void trip_list_add(TripList *list, u32 pattern, u32 *stops, u32 *times, u32 stop_count) {
+	if (list->size + stop_count > list->capacity) {
+		while (list->size + stop_count > list->capacity) {
+			list->capacity *= 2;
+		}
+		list->stops = (u32 *)realloc(list->stops, sizeof(u32) * list->capacity);
+		list->times = (u32 *)realloc(list->times, sizeof(u32) * list->capacity);
+	}
+	if (list->count == list->trip_capacity) {
+		list->trip_capacity *= 2;
+		list->trip_pattern = (u32 *)realloc(list->trip_pattern, sizeof(u32) * list->trip_capacity);
+		list->trip_start = (u32 *)realloc(list->trip_start, sizeof(u32) * list->trip_capacity);
+		list->trip_offset = (u32 *)realloc(list->trip_offset, sizeof(u32) * list->trip_capacity);
+	}
+	list->trip_pattern[list->count] = pattern;
+	list->trip_start[list->count] = times[0];
+	list->trip_offset[list->count] = list->size;
+	list->count++;
+	memcpy(list->stops + list->size, stops, sizeof(u32) * stop_count);
+	memcpy(list->times + list->size, times, sizeof(u32) * stop_count);
+	list->size += stop_count;
+}
+
+/*
+ * Parses one trip line into stops and times. Returns the number of
+ * departures it stands for (more than one with an "every" field) and sets
+ * headway, or 0 with error set.
+ */
+static u32 parse_trip(Graph *g, char *line, char *end, u32 *stops, u32 *times, u32 *stop_count, u32 *headway, char **error) {
+	char *comma = (char *)memchr(line, ',', end - line);
+	if (comma == NULL) {
+		*error = "expected a line and stops";
+		return 0;
+	}
+	StrView line_name = tt_trim(line, comma);
+	*stop_count = 0;
+	*headway = 0;
+	u32 repeats = 1;
+
+	char *cursor = comma + 1;
+	while (cursor < end) {
+		char *next = (char *)memchr(cursor, ',', end - cursor);
+		if (next == NULL) {
+			next = end;
+		}
+		StrView field = tt_trim(cursor, next);
+		cursor = next + 1;
+
+		// "every N until HH:MM"
+		if (field.len > 6 && !memcmp(field.ptr, "every ", 6)) {
+			u32 minutes = 0;
+			u64 i = 6;
+			for (; i < field.len && field.ptr[i] >= '0' && field.ptr[i] <= '9'; i++) {
+				minutes = (minutes * 10) + (field.ptr[i] - '0');
+			}
+			StrView rest = tt_trim(field.ptr + i, field.ptr + field.len);
+			u32 until = NO_TIME;
+			if (rest.len > 6 && !memcmp(rest.ptr, "until ", 6)) {
+				until = parse_clock(tt_trim(rest.ptr + 6, rest.ptr + rest.len));
+			}
+			if (minutes == 0 || until == NO_TIME || *stop_count == 0 || cursor < end) {
+				*error = "expected a final \"every N until HH:MM\"";
+				return 0;
+			}
+			*headway = minutes * 60;
+			repeats = (until >= times[0]) ? ((until - times[0]) / *headway) + 1 : 1;
+			break;
+		}
+
+		char *space = field.ptr + field.len;
+		while (space > field.ptr && space[-1] != ' ') {
+			space--;
+		}
+		if (space == field.ptr) {
+			*error = "expected \"station HH:MM\"";
+			return 0;
+		}
+		StrView station = tt_trim(field.ptr, space);
+		u32 time = parse_clock((StrView){ space, (u64)(field.ptr + field.len - space) });
+		if (time == NO_TIME) {
+			*error = "bad time";
+			return 0;
+		}
+		if (*stop_count > 0 && time < times[*stop_count - 1]) {
+			*error = "times go backwards";
+			return 0;
+		}
+		u32 node = tt_find_platform(g, station, line_name);
+		if (node == NO_NODE) {
+			*error = "not a platform of the network";
+			return 0;
+		}
+		if (*stop_count == MAX_TRIP_STOPS) {
+			*error = "too many stops";
+			return 0;
+		}
+		stops[*stop_count] = node;
+		times[*stop_count] = time;
+		(*stop_count)++;
+	}
+
+	if (*stop_count < 2) {
+		*error = "a trip needs at least two stops";
+		return 0;
+	}
+	return repeats;
+}
+
+static TripList *tt_sort_list;
+
+static int compare_trips(const void *a, const void *b) {
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+	TripList *list = tt_sort_list;
+	if (list->trip_pattern[x] != list->trip_pattern[y]) {
+		return (list->trip_pattern[x] < list->trip_pattern[y]) ? -1 : 1;
+	}
+	if (list->trip_start[x] != list->trip_start[y]) {
+		return (list->trip_start[x] < list->trip_start[y]) ? -1 : 1;
+	}
+	return (x < y) ? -1 : (x > y);
+}
+
+static void tt_change_times(Graph *g, Timetable *tt) {
+	for (u32 s = 0; s < g->station_count; s++) {
+		tt->change_times[s] = 0;
+		bool seen = false;
+		for (u32 i = g->station_offsets[s]; i < g->station_offsets[s + 1]; i++) {
+			u32 u = g->station_nodes[i];
+			for (u32 e = g->edge_offsets[u]; e < g->edge_offsets[u + 1]; e++) {
+				u32 v = g->edge_targets[e];
+				if (v == u || g->node_station[v] != s) {
+					continue;
+				}
+				u32 change = (u32)(g->edge_times[e] * 60.0f + 0.5f);
+				if (!seen || change < tt->change_times[s]) {
+					tt->change_times[s] = change;
+					seen = true;
+				}
+			}
+		}
+	}
+}
+
+Timetable *timetable_load(Graph *g, char *path) {
+	File *file = map_file(path);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	Arena *tmp = arena_init();
+	HashMap *pattern_ids = hm_arena_init(tmp);
+	u32 pattern_count = 0;
+	u32 pattern_capacity = 16;
+	u32 *pattern_offsets = (u32 *)malloc(sizeof(u32) * (pattern_capacity + 1));
+	u32 pattern_stop_size = 0;
+	u32 pattern_stop_capacity = 256;
+	u32 *pattern_stops = (u32 *)malloc(sizeof(u32) * pattern_stop_capacity);
+	pattern_offsets[0] = 0;
+
+	TripList list;
+	memset(&list, 0, sizeof(list));
+	list.capacity = 1024;
+	list.stops = (u32 *)malloc(sizeof(u32) * list.capacity);
+	list.times = (u32 *)malloc(sizeof(u32) * list.capacity);
+	list.trip_capacity = 64;
+	list.trip_pattern = (u32 *)malloc(sizeof(u32) * list.trip_capacity);
+	list.trip_start = (u32 *)malloc(sizeof(u32) * list.trip_capacity);
+	list.trip_offset = (u32 *)malloc(sizeof(u32) * list.trip_capacity);
+
+	u32 stops[MAX_TRIP_STOPS];
+	u32 times[MAX_TRIP_STOPS];
+	u32 line_number = 0;
+	u32 rejected = 0;
+	char *cursor = file->string;
+	char *file_end = file->string + file->size;
+	while (cursor < file_end) {
+		char *line_end = (char *)memchr(cursor, '\n', file_end - cursor);
+		if (line_end == NULL) {
+			line_end = file_end;
+		}
+		char *line = cursor;
+		cursor = line_end + 1;
+		line_number++;
+
+		StrView trimmed = tt_trim(line, line_end);
+		if (trimmed.len == 0 || trimmed.ptr[0] == '#') {
+			continue;
+		}
+
+		u32 stop_count;
+		u32 headway;
+		char *error = NULL;
+		u32 repeats = parse_trip(g, line, line_end, stops, times, &stop_count, &headway, &error);
+		if (repeats == 0) {
+			printf("%s:%u: %s, skipping trip\n", path, line_number, error);
+			rejected++;
+			continue;
+		}
+
+		u64 key_len = sizeof(u32) * stop_count;
+		void *id = hm_getn(pattern_ids, (char *)stops, key_len);
+		u32 pattern;
+		if (id) {
+			pattern = VOIDID(id);
+		} else {
+			if (pattern_count == pattern_capacity) {
+				pattern_capacity *= 2;
+				pattern_offsets = (u32 *)realloc(pattern_offsets, sizeof(u32) * (pattern_capacity + 1));
+			}
+			while (pattern_stop_size + stop_count > pattern_stop_capacity) {
+				pattern_stop_capacity *= 2;
+				pattern_stops = (u32 *)realloc(pattern_stops, sizeof(u32) * pattern_stop_capacity);
+			}
+			memcpy(pattern_stops + pattern_stop_size, stops, key_len);
+			pattern_stop_size += stop_count;
+			pattern = pattern_count++;
+			pattern_offsets[pattern_count] = pattern_stop_size;
+			hm_insertn(&pattern_ids, (char *)stops, key_len, IDVOID(pattern));
+		}
+
+		for (u32 r = 0; r < repeats; r++) {
+			trip_list_add(&list, pattern, stops, times, stop_count);
+			for (u32 i = 0; i < stop_count; i++) {
+				times[i] += headway;
+			}
+		}
+	}
+	close_file(file);
+
+	Arena *arena = arena_init();
+	Timetable *tt = (Timetable *)mem_calloc(arena, 1, sizeof(Timetable));
+	tt->arena = arena;
+	tt->station_count = g->station_count;
+	tt->pattern_count = pattern_count;
+	tt->trip_count = list.count;
+
+	tt->pattern_stop_offsets = (u32 *)mem_alloc(arena, sizeof(u32) * (pattern_count + 1));
+	memcpy(tt->pattern_stop_offsets, pattern_offsets, sizeof(u32) * (pattern_count + 1));
+	tt->pattern_stops = (u32 *)mem_alloc(arena, sizeof(u32) * (pattern_stop_size + 1));
+	memcpy(tt->pattern_stops, pattern_stops, sizeof(u32) * pattern_stop_size);
+
+	// Trips grouped by pattern and sorted by departure, each pattern one trip-major block
+	u32 *order = (u32 *)mem_alloc(tmp, sizeof(u32) * (list.count + 1));
+	for (u32 i = 0; i < list.count; i++) {
+		order[i] = i;
+	}
+	tt_sort_list = &list;
+	qsort(order, list.count, sizeof(u32), compare_trips);
+
+	tt->pattern_trips = (u32 *)mem_calloc(arena, pattern_count + 1, sizeof(u32));
+	tt->pattern_time_offsets = (u32 *)mem_alloc(arena, sizeof(u32) * (pattern_count + 1));
+	tt->times = (u32 *)mem_alloc(arena, sizeof(u32) * (list.size + 1));
+	for (u32 i = 0; i < list.count; i++) {
+		tt->pattern_trips[list.trip_pattern[i]]++;
+	}
+	u32 offset = 0;
+	for (u32 p = 0; p < pattern_count; p++) {
+		tt->pattern_time_offsets[p] = offset;
+		offset += tt->pattern_trips[p] * (pattern_offsets[p + 1] - pattern_offsets[p]);
+	}
+	tt->pattern_time_offsets[pattern_count] = offset;
+	u32 at = 0;
+	for (u32 i = 0; i < list.count; i++) {
+		u32 trip = order[i];
+		u32 p = list.trip_pattern[trip];
+		u32 stop_count = pattern_offsets[p + 1] - pattern_offsets[p];
+		memcpy(tt->times + at, list.times + list.trip_offset[trip], sizeof(u32) * stop_count);
+		at += stop_count;
+	}
+
+	// Invert the pattern stop lists into per station (pattern, position) pairs
+	tt->station_pattern_offsets = (u32 *)mem_calloc(arena, g->station_count + 1, sizeof(u32));
+	tt->station_patterns = (u32 *)mem_alloc(arena, sizeof(u32) * (pattern_stop_size + 1));
+	tt->station_positions = (u32 *)mem_alloc(arena, sizeof(u32) * (pattern_stop_size + 1));
+	for (u32 i = 0; i < pattern_stop_size; i++) {
+		tt->station_pattern_offsets[g->node_station[pattern_stops[i]] + 1]++;
+	}
+	for (u32 s = 0; s < g->station_count; s++) {
+		tt->station_pattern_offsets[s + 1] += tt->station_pattern_offsets[s];
+	}
+	u32 *fill = (u32 *)mem_alloc(tmp, sizeof(u32) * (g->station_count + 1));
+	memcpy(fill, tt->station_pattern_offsets, sizeof(u32) * (g->station_count + 1));
+	for (u32 p = 0; p < pattern_count; p++) {
+		for (u32 i = pattern_offsets[p]; i < pattern_offsets[p + 1]; i++) {
+			u32 slot = fill[g->node_station[pattern_stops[i]]]++;
+			tt->station_patterns[slot] = p;
+			tt->station_positions[slot] = i - pattern_offsets[p];
+		}
+	}
+
+	tt->change_times = (u32 *)mem_alloc(arena, sizeof(u32) * (g->station_count + 1));
+	tt_change_times(g, tt);
+
+	if (rejected) {
+		printf("%s: skipped %u bad trips\n", path, rejected);
+	}
+
+	free(pattern_offsets);
+	free(pattern_stops);
+	free(list.stops);
+	free(list.times);
+	free(list.trip_pattern);
+	free(list.trip_start);
+	free(list.trip_offset);
+	arena_free(tmp);
+	return tt;
+}
+
+void timetable_free(Timetable *tt) {
+	arena_free(tt->arena);
+}
+
+RaptorState *raptor_init(Timetable *tt) {
+	RaptorState *rs = (RaptorState *)malloc(sizeof(RaptorState));
+	u32 s = tt->station_count;
+	rs->station_count = s;
+	rs->pattern_count = tt->pattern_count;
+	rs->arrival = (u32 *)malloc(sizeof(u32) * (RAPTOR_MAX_ROUNDS + 1) * (s + 1));
+	rs->best = (u32 *)malloc(sizeof(u32) * (s + 1));
+	rs->labels = (RaptorLabel *)malloc(sizeof(RaptorLabel) * (RAPTOR_MAX_ROUNDS + 1) * (s + 1));
+	rs->marked = (bool *)calloc(s + 1, sizeof(bool));
+	rs->marked_list = (u32 *)malloc(sizeof(u32) * (s + 1));
+	rs->marked_count = 0;
+	rs->queue_pos = (u32 *)malloc(sizeof(u32) * (tt->pattern_count + 1));
+	rs->queue_list = (u32 *)malloc(sizeof(u32) * (tt->pattern_count + 1));
+	memset(rs->queue_pos, 0xff, sizeof(u32) * (tt->pattern_count + 1));
+	rs->rounds = 0;
+	return rs;
+}
+
+void raptor_free(RaptorState *rs) {
+	free(rs->arrival);
+	free(rs->best);
+	free(rs->labels);
+	free(rs->marked);
+	free(rs->marked_list);
+	free(rs->queue_pos);
+	free(rs->queue_list);
+	free(rs);
+}
+
+static inline void raptor_mark(RaptorState *rs, u32 station) {
+	if (!rs->marked[station]) {
+		rs->marked[station] = true;
+		rs->marked_list[rs->marked_count++] = station;
+	}
+}
+
+// First trip of pattern p leaving position pos at or after ready, or trip_count
+static inline u32 raptor_catch(u32 *times, u32 trip_count, u32 stop_count, u32 pos, u32 ready) {
+	u32 lo = 0;
+	u32 hi = trip_count;
+	while (lo < hi) {
+		u32 mid = (lo + hi) / 2;
+		if (times[(mid * stop_count) + pos] < ready) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void raptor_scan(Graph *g, Timetable *tt, RaptorState *rs, u32 p, u32 from_pos, u32 round, u32 target) {
+	u32 *stops = tt->pattern_stops + tt->pattern_stop_offsets[p];
+	u32 stop_count = tt->pattern_stop_offsets[p + 1] - tt->pattern_stop_offsets[p];
+	u32 trip_count = tt->pattern_trips[p];
+	u32 *times = tt->times + tt->pattern_time_offsets[p];
+	u32 *prev = rs->arrival + ((u64)(round - 1) * rs->station_count);
+	u32 *curr = rs->arrival + ((u64)round * rs->station_count);
+	RaptorLabel *labels = rs->labels + ((u64)round * rs->station_count);
+
+	u32 trip = NO_NODE;
+	u32 board = 0;
+	for (u32 i = from_pos; i < stop_count; i++) {
+		u32 station = g->node_station[stops[i]];
+
+		if (trip != NO_NODE) {
+			u32 arrive = times[(trip * stop_count) + i];
+			u32 bound = (rs->best[station] < rs->best[target]) ? rs->best[station] : rs->best[target];
+			if (arrive < bound) {
+				curr[station] = arrive;
+				rs->best[station] = arrive;
+				labels[station] = (RaptorLabel){ p, trip, board, i };
+				raptor_mark(rs, station);
+			}
+		}
+
+		if (prev[station] == NO_TIME) {
+			continue;
+		}
+		u32 ready = prev[station] + ((round > 1) ? tt->change_times[station] : 0);
+		if (trip == NO_NODE || ready <= times[(trip * stop_count) + i]) {
+			u32 caught = raptor_catch(times, (trip == NO_NODE) ? trip_count : trip, stop_count, i, ready);
+			if (caught < ((trip == NO_NODE) ? trip_count : trip)) {
+				trip = caught;
+				board = i;
+			}
+		}
+	}
+}
+
+/*
+ * Earliest arrival from start_station leaving at depart. Returns the round
+ * (number of trips) of the best arrival at end_station, or NO_NODE.
+ */
+u32 raptor_search(Graph *g, Timetable *tt, RaptorState *rs, u32 start_station, u32 end_station, u32 depart) {
+	u32 s = rs->station_count;
+	memset(rs->arrival, 0xff, sizeof(u32) * (RAPTOR_MAX_ROUNDS + 1) * s);
+	memset(rs->best, 0xff, sizeof(u32) * s);
+	rs->arrival[start_station] = depart;
+	rs->best[start_station] = depart;
+	rs->marked_count = 0;
+	raptor_mark(rs, start_station);
+
+	u32 round = 1;
+	for (; round <= RAPTOR_MAX_ROUNDS && rs->marked_count > 0; round++) {
+		// Each pattern once, from the earliest position a marked station has on it
+		u32 queued = 0;
+		for (u32 m = 0; m < rs->marked_count; m++) {
+			u32 station = rs->marked_list[m];
+			rs->marked[station] = false;
+			for (u32 i = tt->station_pattern_offsets[station]; i < tt->station_pattern_offsets[station + 1]; i++) {
+				u32 p = tt->station_patterns[i];
+				u32 pos = tt->station_positions[i];
+				if (rs->queue_pos[p] == NO_NODE) {
+					rs->queue_list[queued++] = p;
+					rs->queue_pos[p] = pos;
+				} else if (pos < rs->queue_pos[p]) {
+					rs->queue_pos[p] = pos;
+				}
+			}
+		}
+		rs->marked_count = 0;
+
+		for (u32 q = 0; q < queued; q++) {
+			u32 p = rs->queue_list[q];
+			raptor_scan(g, tt, rs, p, rs->queue_pos[p], round, end_station);
+			rs->queue_pos[p] = NO_NODE;
+		}
+	}
+	for (u32 m = 0; m < rs->marked_count; m++) {
+		rs->marked[rs->marked_list[m]] = false;
+	}
+	rs->rounds = round - 1;
+
+	u32 best_round = NO_NODE;
+	u32 best_time = NO_TIME;
+	for (u32 k = 0; k < round; k++) {
+		u32 t = rs->arrival[((u64)k * s) + end_station];
+		if (t < best_time) {
+			best_time = t;
+			best_round = k;
+		}
+	}
+	return best_round;
+}
+
+/*
+ * Same front end as find_best_route: a Route in ctx's arena whose path is
+ * every platform ridden through, with accum_time in minutes from depart to
+ * arrival, waiting included.
+ */
+Route *find_timetable_route(Graph *g, Timetable *tt, RaptorState *rs, SearchContext *ctx, char *start, char *end, u32 depart) {
+	u32 start_station = graph_find_station(g, start);
+	u32 end_station = graph_find_station(g, end);
+	if (start_station == NO_NODE || end_station == NO_NODE) {
+		return NULL;
+	}
+
+	search_begin(ctx, g);
+	u32 round = raptor_search(g, tt, rs, start_station, end_station, depart);
+	if (round == NO_NODE) {
+		return new_route(ctx->arena, INFINITY, start, NO_NODE, end, NO_NODE);
+	}
+
+	u32 arrive = rs->arrival[((u64)round * rs->station_count) + end_station];
+	Route *route = new_route(ctx->arena, (arrive - depart) / 60.0f, start, NO_NODE, end, NO_NODE);
+	if (round == 0) {
+		route->path = (u32 *)mem_alloc(ctx->arena, sizeof(u32));
+		route->path[0] = g->station_nodes[g->station_offsets[start_station]];
+		route->path_size = 1;
+		route->start_node = route->end_node = route->path[0];
+		return route;
+	}
+
+	// Walk the legs backwards once to size the path, then fill it front to back
+	RaptorLabel legs[RAPTOR_MAX_ROUNDS];
+	u32 station = end_station;
+	u64 path_size = 0;
+	for (u32 k = round; k > 0; k--) {
+		RaptorLabel leg = rs->labels[((u64)k * rs->station_count) + station];
+		legs[k - 1] = leg;
+		path_size += leg.alight - leg.board + 1;
+		station = g->node_station[tt->pattern_stops[tt->pattern_stop_offsets[leg.pattern] + leg.board]];
+	}
+
+	u32 *path = (u32 *)mem_alloc(ctx->arena, sizeof(u32) * path_size);
+	u64 at = 0;
+	for (u32 k = 0; k < round; k++) {
+		u32 *stops = tt->pattern_stops + tt->pattern_stop_offsets[legs[k].pattern];
+		for (u32 i = legs[k].board; i <= legs[k].alight; i++) {
+			// Staying on the same platform between two trips is not a hop
+			if (at > 0 && path[at - 1] == stops[i]) {
+				continue;
+			}
+			path[at++] = stops[i];
+		}
+	}
+
+	route->path = path;
+	route->path_size = at;
+	route->start_node = path[0];
+	route->end_node = path[at - 1];
+	return route;
+}
+
+#endif